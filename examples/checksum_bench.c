@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* Board benchmark: _crc32() and _adler32() over N sectors against
+ * disk_read() of the same N sectors from the SD card, timed with the 1 MHz
+ * timer. A checksum that keeps up with the card costs little when it runs
+ * as a file is loaded. The results go to stdout.
+ *
+ * disk_read() is the FatFs disk interface, so this needs FatFs' headers:
+ *
+ *   m68k-elf-gcc -O2 -I/path/to/nextp8-bsp/include \
+ *     -I/path/to/nextp8-bsp/src/ff16/source -o checksum_bench.elf \
+ *     examples/checksum_bench.c -L/path/to/nextp8-bsp \
+ *     -T/path/to/nextp8-bsp/nextp8-ram.ld
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "ff.h"
+#include "diskio.h"
+#include "mmio.h"
+#include "nextp8.h"
+
+#define REPEAT 20
+#define SECTOR_SIZE 512
+#define MAX_SECTORS 64
+
+/* Print the time of one call, from the total for REPEAT calls, and the
+   throughput over len bytes. */
+static void report(const char *name, unsigned sectors, uint32_t us, size_t len)
+{
+  unsigned long per_call = us / REPEAT;
+  printf("%-10s %2u sectors %8lu us %6lu KB/s\n", name, sectors, per_call,
+         per_call ? (unsigned long)((uint64_t)len * 1000000 / 1024 / per_call) : 0);
+}
+
+int main(void)
+{
+  static const unsigned counts[] = { 2, 8, 64 };
+  volatile uint32_t sum = 0;
+  uint8_t *buf;
+  uint64_t start;
+  size_t len;
+  unsigned i;
+  int n;
+
+  buf = malloc(MAX_SECTORS * SECTOR_SIZE);
+  if (buf == NULL || disk_initialize(0) & STA_NOINIT)
+    {
+      printf("No memory or no SD card\n");
+      return 1;
+    }
+  for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+    {
+      len = counts[i] * SECTOR_SIZE;
+
+      /* Reads of more than one sector go straight to the card, not
+         through the sector cache. */
+      start = MMIO_REG64(_UTIMER_1MHZ);
+      for (n = 0; n < REPEAT; n++)
+        if (disk_read(0, buf, 0, counts[i]) != RES_OK)
+          {
+            printf("disk_read failed\n");
+            return 1;
+          }
+      report("disk_read", counts[i], MMIO_REG64(_UTIMER_1MHZ) - start, len);
+
+      start = MMIO_REG64(_UTIMER_1MHZ);
+      for (n = 0; n < REPEAT; n++)
+        sum += _crc32(0, buf, len);
+      report("_crc32", counts[i], MMIO_REG64(_UTIMER_1MHZ) - start, len);
+
+      start = MMIO_REG64(_UTIMER_1MHZ);
+      for (n = 0; n < REPEAT; n++)
+        sum += _adler32(1, buf, len);
+      report("_adler32", counts[i], MMIO_REG64(_UTIMER_1MHZ) - start, len);
+    }
+  return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* Board benchmark: _fb_fill() and _fb_copy() against newlib's memset() and
+ * memcpy(), on a whole 8 KB frame buffer and on its 128 rows of 64 bytes
+ * one at a time, timed with the 1 MHz timer. The results go to stdout.
+ *
+ *   m68k-elf-gcc -O2 -I/path/to/nextp8-bsp/include -o fb_bench.elf \
+ *     examples/fb_bench.c -L/path/to/nextp8-bsp \
+ *     -T/path/to/nextp8-bsp/nextp8-ram.ld
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "mmio.h"
+#include "nextp8.h"
+
+#define REPEAT 100
+#define ROW_SIZE (_FRAME_BUFFER_SIZE / _SCREEN_HEIGHT)
+
+static uint8_t *const back_buffer = (uint8_t *)_BACK_BUFFER_BASE;
+uint8_t ram_buffer[_FRAME_BUFFER_SIZE];
+
+static void fb_fill_8k(void)
+{
+  _fb_fill(back_buffer, 7, _FRAME_BUFFER_SIZE);
+}
+
+static void memset_8k(void)
+{
+  memset(back_buffer, 0x77, _FRAME_BUFFER_SIZE);
+}
+
+static void fb_copy_8k(void)
+{
+  _fb_copy(back_buffer, ram_buffer, _FRAME_BUFFER_SIZE);
+}
+
+static void memcpy_8k(void)
+{
+  memcpy(back_buffer, ram_buffer, _FRAME_BUFFER_SIZE);
+}
+
+static void fb_fill_rows(void)
+{
+  int y;
+  for (y = 0; y < _SCREEN_HEIGHT; y++)
+    _fb_fill(back_buffer + y * ROW_SIZE, 7, ROW_SIZE);
+}
+
+static void memset_rows(void)
+{
+  int y;
+  for (y = 0; y < _SCREEN_HEIGHT; y++)
+    memset(back_buffer + y * ROW_SIZE, 0x77, ROW_SIZE);
+}
+
+static void fb_copy_rows(void)
+{
+  int y;
+  for (y = 0; y < _SCREEN_HEIGHT; y++)
+    _fb_copy(back_buffer + y * ROW_SIZE, ram_buffer + y * ROW_SIZE, ROW_SIZE);
+}
+
+static void memcpy_rows(void)
+{
+  int y;
+  for (y = 0; y < _SCREEN_HEIGHT; y++)
+    memcpy(back_buffer + y * ROW_SIZE, ram_buffer + y * ROW_SIZE, ROW_SIZE);
+}
+
+/* Print the time fn takes, in microseconds to two decimal places. */
+static void bench(const char *name, void (*fn)(void))
+{
+  uint64_t start;
+  uint32_t us;
+  int i;
+
+  start = MMIO_REG64(_UTIMER_1MHZ);
+  for (i = 0; i < REPEAT; i++)
+    fn();
+  us = MMIO_REG64(_UTIMER_1MHZ) - start;
+  printf("%-24s %6lu.%02lu us\n", name, (unsigned long)(us / REPEAT),
+         (unsigned long)(us % REPEAT * 100 / REPEAT));
+}
+
+int main(void)
+{
+  size_t i;
+  for (i = 0; i < sizeof(ram_buffer); i++)
+    ram_buffer[i] = i;
+
+  bench("_fb_fill 8 KB", fb_fill_8k);
+  bench("memset 8 KB", memset_8k);
+  bench("_fb_copy 8 KB", fb_copy_8k);
+  bench("memcpy 8 KB", memcpy_8k);
+  bench("_fb_fill 128 x 64 B", fb_fill_rows);
+  bench("memset 128 x 64 B", memset_rows);
+  bench("_fb_copy 128 x 64 B", fb_copy_rows);
+  bench("memcpy 128 x 64 B", memcpy_rows);
+  return 0;
+}
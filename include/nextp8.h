@@ -18,6 +18,7 @@
 #ifndef __ASSEMBLER__
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 #endif
 
 #define _MEMIO_BASE         0x800000
@@ -127,6 +128,7 @@
 #define _FONT_CHAR_WIDTH    4
 #define _FONT_CHAR_HEIGHT   5
 #define _FONT_LINE_HEIGHT   (_FONT_CHAR_HEIGHT + 1)
+#define _TRANSPARENT        (-1)        /* bg for _draw_char(): leave it */
 
 /* UART Control/Status Bits */
 #define _UART_STATUS_DATA_READY    (1 << 0)    /* Read: Data available */
@@ -136,8 +138,32 @@
 #define _UART_CTRL_WRITE_STROBE    (1 << 0)    /* Write: Strobe to send */
 #define _UART_CTRL_READ_STROBE     (1 << 1)    /* Write: Strobe to read */
 
-/* UART Baud Rate Dividers (for 115200 baud with ~11 MHz clock) */
-#define _UART_BAUD_115200          95          /* 11000000 / (115200 * 16) ≈ 95 */
+/* UART input modes for _uart_set_mode() */
+#define _UART_ICANON               (1 << 0)    /* Line at a time, with editing */
+#define _UART_ECHO                 (1 << 1)    /* Echo input */
+#define _UART_ICRNL                (1 << 2)    /* Turn CR into NL */
+
+/* UART Baud Rate Dividers: baud = _UART_CLOCK_HZ / divider */
+#define _UART_CLOCK_HZ             11000000
+#define _UART_BAUD_115200          95          /* 11000000 / 115200 ≈ 95 */
+#define _UART_BAUD_OPTION          "--baud="   /* command line: start at this rate */
+
+/* _VBLANK_INTR_CTRL: interrupt at each vblank; written again to acknowledge */
+#define _VBLANK_INTR_ENABLE 0x01
+#define _VBLANK_IRQ_LEVEL   4           /* autovectored */
+
+/* Console modes for _console_enable() */
+#define _CONSOLE_OFF        0
+#define _CONSOLE_SCREEN     1           /* draw in the back buffer and flip */
+#define _CONSOLE_OVERLAY    2           /* draw in the overlay, bg transparent */
+
+/* Extra open() flags understood by the BSP */
+#define _O_DIRECT           0x80000     /* Same as newlib's O_DIRECT: bypass the sector cache */
+#define _O_DECOMPRESS       0x40000000  /* Read a .p8z file's uncompressed contents */
+
+/* Checksum types for _checksum_start() and _checksum_file() */
+#define _CHECKSUM_CRC32     1
+#define _CHECKSUM_ADLER32   2
 
 #define _TUBE_STDOUT        0xfffffe
 #define _TUBE_STDERR        0xffffff
@@ -214,7 +240,13 @@ extern int _ignore_sdcard_errors;
 extern void _set_postcode(int postcode);
 extern void _clear_screen(int colour_index);
 extern void _copy_front_to_back(void);
+extern void _clear_overlay(int colour_index);
+extern void _copy_overlay_front_to_back(void);
+extern void _fb_fill(void *dst, int colour_index, size_t len);
+extern void _fb_copy(void *dst, const void *src, size_t len);
+extern void _load_palette(uintptr_t base, const uint8_t *colours);
 extern void _format_version(char *out, size_t size, const char *prefix, uint32_t version, uint32_t timestamp);
+extern void _draw_char(void *buffer, int x, int y, int c, int fg, int bg);
 extern void _display_string(int x, int y, const char *s);
 extern void _display_string_centered(int x, int y, const char *s);
 extern int _esp_read_byte(unsigned char *byte, unsigned timeout_us);
@@ -232,6 +264,17 @@ extern void __attribute__ ((noreturn)) _halt(void);
 extern void __attribute__ ((noreturn)) _restart(void);
 #endif
 extern void _uart_write(const char *buf, size_t count);
+#ifndef ROM
+extern void _uart_poll(void);
+extern void _uart_flush(void);
+extern size_t _uart_tx_free(void);
+extern ssize_t _uart_read(void *buf, size_t count);
+extern int _uart_getc(void);
+extern void _uart_set_mode(int mode, unsigned vmin, unsigned vtime);
+extern long _uart_set_baud(unsigned long baud, long *error_ppm);
+extern void _uart_init_baud(void);
+extern const unsigned long _uart_default_baud;
+#endif
 extern void _wait_for_any_key(void);
 extern void __attribute__ ((noreturn)) _warm_reset(void);
 extern void __attribute__ ((noreturn)) _shutdown(void);
@@ -245,7 +288,83 @@ extern int _read_rtc(unsigned *date, unsigned *month, unsigned *year,
                      unsigned *wday);
 extern void _recoverable_error(const char *format, ...);
 extern void _show_message(const char *format, ...);
+extern size_t _stderr_tail(char *buf, size_t size, unsigned lines);
+extern const size_t _stderr_capture_size;
+
+struct _fatfs_map;
+extern struct _fatfs_map *_fatfs_map(int fd, off_t offset, size_t len);
+extern const void *_fatfs_map_get(struct _fatfs_map *map, size_t offset, size_t *avail);
+extern int _fatfs_unmap(struct _fatfs_map *map);
+extern int _fatfs_freemap_build(unsigned max_sectors);
+extern void _fatfs_idle(void);
+extern void _idle(void);
+extern int _fatfs_preallocate(int fd, off_t size);
+extern int _fatfs_index_dir(const char *path);
+extern size_t _heap_free(void);
+extern int _ramfs_init(size_t size);
+extern int _pack_mount(const char *name, const char *path);
+extern int _pack_unmount(const char *name);
+extern int _log_open(const char *path, size_t size, unsigned flush_ms);
+extern ssize_t _log_write(int log, const void *buf, size_t count);
+extern int _log_flush(int log);
+extern int _log_close(int log);
+extern void _log_poll(void);
+extern void _log_flush_all(void);
+extern uint32_t _crc32(uint32_t crc, const void *buf, size_t len);
+extern uint32_t _adler32(uint32_t adler, const void *buf, size_t len);
+extern int _checksum_start(int fd, int type);
+extern int _checksum_end(int fd, uint32_t *sum);
+extern int _checksum_file(const char *path, int type, uint32_t *sum);
+extern int _xfer_receive(char *path, size_t path_size, unsigned timeout_ms);
+extern void _trace_emit(uint32_t id, unsigned nargs, const uint32_t *args);
+extern int _trace_to_uart(void);
+extern int _trace_to_file(const char *path);
+extern void _trace_poll(void);
+extern void _trace_flush(void);
+extern void _flip_async(void);
+extern void _flip_wait(void);
+extern int _flip_pending(void);
+extern void _vblank_enable(void);
+extern void _vblank_disable(void);
+extern int _vblank_add(void (*fn)(void *), void *arg);
+extern int _vblank_remove(void (*fn)(void *), void *arg);
+struct _frame_stats {
+    uint32_t vblanks;   /* since _vblank_enable() */
+    uint32_t flips;     /* completed */
+    uint32_t missed;    /* extra vblanks a frame stayed on screen */
+};
+extern void _frame_stats(struct _frame_stats *stats);
+extern int _console_enable(int mode, int fg, int bg);
+extern void _console_poll(void);
+extern void _console_flush(void);
+#endif
+
+/* _TRACE(fmt, ...) records a trace event with up to six integer or pointer
+   arguments. The format is only used by the host decoder, tools/p8trace.c;
+   see src/trace.c. */
+#ifndef ROM
+#define _TRACE(fmt, ...) do {                                               \
+    static const char _trace_fmt[]                                          \
+      __attribute__ ((section (".trace_fmt"), used)) = fmt;                 \
+    const uint32_t _trace_args[] = {                                        \
+      0 _TRACE_WORDS(_TRACE_NARGS(__VA_ARGS__), ##__VA_ARGS__) };           \
+    _trace_emit((uintptr_t)_trace_fmt, _TRACE_NARGS(__VA_ARGS__),           \
+                _trace_args + 1);                                           \
+  } while (0)
+#else
+#define _TRACE(fmt, ...) do { } while (0)
 #endif
+#define _TRACE_NARGS(...) _TRACE_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define _TRACE_NARGS_(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+#define _TRACE_WORDS(n, ...) _TRACE_WORDS_(n, ##__VA_ARGS__)
+#define _TRACE_WORDS_(n, ...) _TRACE_WORDS##n(__VA_ARGS__)
+#define _TRACE_WORDS0()
+#define _TRACE_WORDS1(a) , (uint32_t)(uintptr_t)(a)
+#define _TRACE_WORDS2(a, ...) , (uint32_t)(uintptr_t)(a) _TRACE_WORDS1(__VA_ARGS__)
+#define _TRACE_WORDS3(a, ...) , (uint32_t)(uintptr_t)(a) _TRACE_WORDS2(__VA_ARGS__)
+#define _TRACE_WORDS4(a, ...) , (uint32_t)(uintptr_t)(a) _TRACE_WORDS3(__VA_ARGS__)
+#define _TRACE_WORDS5(a, ...) , (uint32_t)(uintptr_t)(a) _TRACE_WORDS4(__VA_ARGS__)
+#define _TRACE_WORDS6(a, ...) , (uint32_t)(uintptr_t)(a) _TRACE_WORDS5(__VA_ARGS__)
 
 #endif /* __ASSEMBLER__ */
 
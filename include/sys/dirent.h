@@ -15,6 +15,7 @@
 #ifndef DIRENT_H
 #define DIRENT_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 struct _DIR;
@@ -29,4 +30,22 @@ struct dirent {
 	char    	d_name[255 + 1];
 };
 
+/* Compact directory entry filled in by _readdir_batch. d_name points into
+   the caller's name buffer (or at a string constant for ".."). */
+struct _dirent_entry {
+	const char	*d_name;
+	uint32_t	d_size;
+	uint16_t	d_date;
+	uint16_t	d_time;
+	uint8_t	    d_attrib;
+};
+
+/* _readdir_batch flags */
+#define _READDIR_SORT		0x01	/* sort each batch by name */
+#define _READDIR_DIRS_FIRST	0x02	/* with _READDIR_SORT, directories before files */
+#define _READDIR_NO_DOTDOT	0x04	/* leave out the ".." entry */
+
+extern int _readdir_batch(DIR *dirp, struct _dirent_entry *entries, int max_entries,
+			  char *names, size_t names_size, const char *ext, int flags);
+
 #endif
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* CRC-32 and Adler-32, as used by zip and zlib.
+ *
+ * Both functions take the value returned for the data so far, so a stream
+ * can be checksummed a piece at a time; start CRC-32 from 0 and Adler-32
+ * from 1. CRC-32 uses four tables to consume an aligned word per step
+ * instead of a byte. _checksum_start() makes read() and readv() keep a
+ * running checksum of everything they return for a descriptor, so verifying
+ * a file as it is loaded needs no second pass over it. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "io.h"
+#include "nextp8.h"
+
+#ifndef ROM
+#define CRC32_POLY 0xEDB88320u
+#define ADLER_BASE 65521u
+/* Largest n such that 255n(n+1)/2 + (n+1)(BASE-1) fits in 32 bits, so
+   Adler-32 can defer its modulo for this many bytes. */
+#define ADLER_NMAX 5552
+#define CHECKSUM_FILE_BUF 4096
+
+#define SWAP32(x) ((((x) >> 24) & 0xff) | (((x) >> 8) & 0xff00) \
+                   | (((x) & 0xff00) << 8) | (((x) & 0xff) << 24))
+
+/* crc_table[0] is the usual byte table. crc_table[k][n] is the CRC of byte n
+   followed by k zero bytes. On a big-endian CPU the entries are stored byte
+   swapped, so that a word can be combined with the CRC as it is loaded. */
+static uint32_t crc_table[4][256];
+static int crc_table_ready;
+
+static void make_crc_table(void)
+{
+  unsigned n, k;
+  for (n = 0; n < 256; n++)
+    {
+      uint32_t c = n;
+      for (k = 0; k < 8; k++)
+        c = (c & 1) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+      crc_table[0][n] = c;
+    }
+  for (n = 0; n < 256; n++)
+    {
+      uint32_t c = crc_table[0][n];
+      for (k = 1; k < 4; k++)
+        {
+          c = crc_table[0][c & 0xff] ^ (c >> 8);
+          crc_table[k][n] = c;
+        }
+    }
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  for (k = 0; k < 4; k++)
+    for (n = 0; n < 256; n++)
+      crc_table[k][n] = SWAP32(crc_table[k][n]);
+#endif
+  crc_table_ready = 1;
+}
+
+uint32_t _crc32(uint32_t crc, const void *buf, size_t len)
+{
+  const uint8_t *p = buf;
+  const uint32_t *p4;
+  uint32_t c;
+
+  if (!crc_table_ready)
+    make_crc_table();
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  c = SWAP32(~crc);
+  while (len > 0 && ((uintptr_t)p & 3) != 0)
+    {
+      c = crc_table[0][(c >> 24) ^ *p++] ^ (c << 8);
+      len--;
+    }
+  p4 = (const uint32_t *)p;
+  while (len >= 4)
+    {
+      c ^= *p4++;
+      c = crc_table[3][c >> 24] ^ crc_table[2][(c >> 16) & 0xff]
+          ^ crc_table[1][(c >> 8) & 0xff] ^ crc_table[0][c & 0xff];
+      len -= 4;
+    }
+  p = (const uint8_t *)p4;
+  while (len > 0)
+    {
+      c = crc_table[0][(c >> 24) ^ *p++] ^ (c << 8);
+      len--;
+    }
+  return ~SWAP32(c);
+#else
+  c = ~crc;
+  while (len > 0 && ((uintptr_t)p & 3) != 0)
+    {
+      c = crc_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+      len--;
+    }
+  p4 = (const uint32_t *)p;
+  while (len >= 4)
+    {
+      c ^= *p4++;
+      c = crc_table[3][c & 0xff] ^ crc_table[2][(c >> 8) & 0xff]
+          ^ crc_table[1][(c >> 16) & 0xff] ^ crc_table[0][c >> 24];
+      len -= 4;
+    }
+  p = (const uint8_t *)p4;
+  while (len > 0)
+    {
+      c = crc_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+      len--;
+    }
+  return ~c;
+#endif
+}
+
+uint32_t _adler32(uint32_t adler, const void *buf, size_t len)
+{
+  const uint8_t *p = buf;
+  uint32_t a = adler & 0xffff, b = adler >> 16;
+  while (len > 0)
+    {
+      size_t n = len < ADLER_NMAX ? len : ADLER_NMAX;
+      len -= n;
+      while (n >= 8)
+        {
+          a += p[0]; b += a;
+          a += p[1]; b += a;
+          a += p[2]; b += a;
+          a += p[3]; b += a;
+          a += p[4]; b += a;
+          a += p[5]; b += a;
+          a += p[6]; b += a;
+          a += p[7]; b += a;
+          p += 8;
+          n -= 8;
+        }
+      while (n > 0)
+        {
+          a += *p++;
+          b += a;
+          n--;
+        }
+      a %= ADLER_BASE;
+      b %= ADLER_BASE;
+    }
+  return (b << 16) | a;
+}
+
+/* Called by read() and readv() with the data they return. */
+void _checksum_update(struct _file *file, const void *buf, size_t len)
+{
+  if (file->sum_type == _CHECKSUM_CRC32)
+    file->sum = _crc32(file->sum, buf, len);
+  else if (file->sum_type == _CHECKSUM_ADLER32)
+    file->sum = _adler32(file->sum, buf, len);
+}
+
+int _checksum_start(int fd, int type)
+{
+  struct _file *file = _get_file(fd);
+  if (file == NULL)
+    return -1;
+  if (type != _CHECKSUM_CRC32 && type != _CHECKSUM_ADLER32)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  file->sum_type = type;
+  file->sum = type == _CHECKSUM_ADLER32 ? 1 : 0;
+  return 0;
+}
+
+int _checksum_end(int fd, uint32_t *sum)
+{
+  struct _file *file = _get_file(fd);
+  if (file == NULL)
+    return -1;
+  if (file->sum_type == 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  *sum = file->sum;
+  file->sum_type = 0;
+  return 0;
+}
+
+int _checksum_file(const char *path, int type, uint32_t *sum)
+{
+  char *buf;
+  ssize_t n;
+  int fd, ret;
+  buf = malloc(CHECKSUM_FILE_BUF);
+  if (buf == NULL)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    {
+      free(buf);
+      return -1;
+    }
+  ret = _checksum_start(fd, type);
+  if (ret == 0)
+    {
+      while ((n = read(fd, buf, CHECKSUM_FILE_BUF)) > 0)
+        ;
+      ret = n < 0 ? -1 : _checksum_end(fd, sum);
+    }
+  close(fd);
+  free(buf);
+  return ret;
+}
+#endif
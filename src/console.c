@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* Text console on the frame buffer.
+ *
+ * Once _console_enable() has been called, everything written to stdout and
+ * stderr also appears on the screen, in a grid of 32 by 21 characters.
+ * Writing only updates a copy of the text and marks the rows it changed.
+ * The pixels are brought up to date at most once per frame: scrolling is a
+ * _fb_copy() of the rows that remain, and only the changed rows are drawn
+ * again.
+ *
+ * _CONSOLE_SCREEN draws into the back buffer and flips, so the console has
+ * the screen to itself. _CONSOLE_OVERLAY draws into both overlay buffers
+ * and never flips: the text appears over whatever the program shows, with
+ * the background colour transparent.
+ *
+ * Output that arrives less than a frame after the last update is drawn by
+ * the next _console_poll(), which _idle() calls, or by the next
+ * write after the frame has passed. _exit() calls _console_flush(). */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include "io.h"
+#include "mmio.h"
+#include "nextp8.h"
+
+#ifndef ROM
+#define CONSOLE_COLS (_SCREEN_WIDTH / _FONT_CHAR_WIDTH)
+#define CONSOLE_ROWS (_SCREEN_HEIGHT / _FONT_LINE_HEIGHT)
+#define LINE_BYTES (_SCREEN_WIDTH / 2)
+#define ROW_BYTES (_FONT_LINE_HEIGHT * LINE_BYTES)
+#define TAB_WIDTH 4
+
+static int mode = _CONSOLE_OFF;
+static int fg, bg;
+static char text[CONSOLE_ROWS][CONSOLE_COLS];
+static int row, col;
+static uint32_t dirty;                  /* bit n: row n must be drawn */
+static unsigned scroll_pending;         /* rows to move up before drawing */
+static uint64_t last_update;
+
+static unsigned frame_us(void)
+{
+  return (_config_data && _config_data->frequency == 0) ? 20000 : 16667;
+}
+
+static void draw_row(uint8_t *buf, int r)
+{
+  int c;
+  for (c = 0; c < CONSOLE_COLS; c++)
+    _draw_char(buf, c * _FONT_CHAR_WIDTH, r * _FONT_LINE_HEIGHT, text[r][c],
+               fg, bg);
+  /* The gap between lines. */
+  _fb_fill(buf + r * ROW_BYTES + _FONT_CHAR_HEIGHT * LINE_BYTES, bg,
+           LINE_BYTES);
+}
+
+static void update_buffer(uint8_t *buf)
+{
+  int r;
+  if (scroll_pending > 0)
+    _fb_copy(buf, buf + scroll_pending * ROW_BYTES,
+             (CONSOLE_ROWS - scroll_pending) * ROW_BYTES);
+  for (r = 0; r < CONSOLE_ROWS; r++)
+    if (dirty & ((uint32_t)1 << r))
+      draw_row(buf, r);
+}
+
+static void update(void)
+{
+  if (mode == _CONSOLE_SCREEN)
+    {
+      update_buffer((uint8_t *)_BACK_BUFFER_BASE);
+      _flip();
+      /* The new back buffer is a frame behind. */
+      _copy_front_to_back();
+    }
+  else
+    {
+      update_buffer((uint8_t *)_OVERLAY_BACK_BUFFER_BASE);
+      update_buffer((uint8_t *)_OVERLAY_FRONT_BUFFER_BASE);
+    }
+  dirty = 0;
+  scroll_pending = 0;
+  last_update = MMIO_REG64(_UTIMER_1MHZ);
+}
+
+static void newline(void)
+{
+  col = 0;
+  if (++row < CONSOLE_ROWS)
+    return;
+  row = CONSOLE_ROWS - 1;
+  memmove(text[0], text[1], (CONSOLE_ROWS - 1) * CONSOLE_COLS);
+  memset(text[row], ' ', CONSOLE_COLS);
+  dirty = (dirty >> 1) | ((uint32_t)1 << row);
+  if (scroll_pending < CONSOLE_ROWS - 1)
+    scroll_pending++;
+  else
+    {
+      /* Everything has scrolled away: draw it all instead. */
+      scroll_pending = 0;
+      dirty = ((uint32_t)1 << CONSOLE_ROWS) - 1;
+    }
+}
+
+void _console_write(const void *buf, size_t count)
+{
+  const char *p = buf;
+  if (mode == _CONSOLE_OFF)
+    return;
+  while (count-- > 0)
+    {
+      char c = *p++;
+      switch (c)
+        {
+        case '\n':
+          newline();
+          break;
+        case '\r':
+          col = 0;
+          break;
+        case '\b':
+          if (col > 0)
+            col--;
+          break;
+        case '\t':
+          col = (col + TAB_WIDTH) & ~(TAB_WIDTH - 1);
+          if (col >= CONSOLE_COLS)
+            newline();
+          break;
+        default:
+          if (c < 32 || c >= 127)
+            break;
+          if (col == CONSOLE_COLS)
+            newline();
+          text[row][col++] = c;
+          dirty |= (uint32_t)1 << row;
+          break;
+        }
+    }
+  _console_poll();
+}
+
+void _console_poll(void)
+{
+  if (mode == _CONSOLE_OFF || (dirty == 0 && scroll_pending == 0))
+    return;
+  if (MMIO_REG64(_UTIMER_1MHZ) - last_update >= frame_us())
+    update();
+}
+
+void _console_flush(void)
+{
+  if (mode != _CONSOLE_OFF && (dirty != 0 || scroll_pending != 0))
+    update();
+}
+
+/* Show stdout and stderr on the screen (_CONSOLE_SCREEN), over it
+   (_CONSOLE_OVERLAY), or no longer (_CONSOLE_OFF). */
+int _console_enable(int new_mode, int new_fg, int new_bg)
+{
+  if (new_mode != _CONSOLE_OFF && new_mode != _CONSOLE_SCREEN
+      && new_mode != _CONSOLE_OVERLAY)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  _console_flush();
+  if (mode == _CONSOLE_OVERLAY)
+    MMIO_REG8(_OVERLAY_CONTROL) = 0;
+  mode = new_mode;
+  if (mode == _CONSOLE_OFF)
+    return 0;
+  fg = new_fg & 15;
+  bg = new_bg & 15;
+  memset(text, ' ', sizeof(text));
+  row = col = 0;
+  dirty = 0;
+  scroll_pending = 0;
+  if (mode == _CONSOLE_SCREEN)
+    {
+      _clear_screen(bg);
+      _flip();
+      _copy_front_to_back();
+    }
+  else
+    {
+      _fb_fill((void *)_OVERLAY_BACK_BUFFER_BASE, bg, _FRAME_BUFFER_SIZE);
+      _fb_fill((void *)_OVERLAY_FRONT_BUFFER_BASE, bg, _FRAME_BUFFER_SIZE);
+      MMIO_REG8(_OVERLAY_CONTROL) = _OVERLAY_ENABLE_BIT | (bg & _OVERLAY_TRANSPARENT_MASK);
+    }
+  last_update = MMIO_REG64(_UTIMER_1MHZ);
+  return 0;
+}
+#endif
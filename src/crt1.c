@@ -59,7 +59,13 @@ static int decode_cmdline(char **argv_out, int max_args)
     char *p = _config_data->cmdline;
 
     while (*p != '\0' && argc < max_args) {
+#ifndef ROM
+        /* Taken by _uart_init_baud(), not for the application. */
+        if (strncmp(p, _UART_BAUD_OPTION, strlen(_UART_BAUD_OPTION)) != 0)
+            argv_out[argc++] = p;
+#else
         argv_out[argc++] = p;
+#endif
         while (*p != '\0')
             p++;
         p++;
@@ -95,6 +101,10 @@ void __start1 (char *initial_stack)
   if (software_init_hook)
     software_init_hook ();
 
+#ifndef ROM
+  _uart_init_baud();
+#endif
+
   _set_postcode(8);
 
   _init ();
@@ -153,6 +163,7 @@ void __attribute__ ((weak)) hardware_init_hook (void)
   MMIO_REG8(_SDSPI_DATA_IN)      = 0x0000;
   MMIO_REG8(_SDSPI_CHIP_SELECT)  = 0x0003;
   MMIO_REG8(_VFRONTREQ)           = 0x00;
+  MMIO_REG8(_VBLANK_INTR_CTRL)    = 0x00;
   MMIO_REG8(_OVERLAY_CONTROL)     = 0x00;
   MMIO_REG16(_PARAMS)             = 0x0000;
   MMIO_REG8(_I2C_DATA)            = 0x00;
@@ -0,0 +1,691 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* Per-directory lookup index.
+ *
+ * Finding a name in a FAT directory means walking its 32-byte entries from
+ * the start, which gets slow in a cart library of a few thousand files.
+ * _dirindex_build(), behind _fatfs_index_dir(), gives a directory a hidden
+ * file, _DIRINDEX_NAME, mapping a hash of each name to the offset of its
+ * entry block. A call that writes to the directory also builds one once a
+ * lookup there has had to examine DIRINDEX_MIN_ENTRIES entries; lookups
+ * alone, such as stat() or opening a file for reading, never write to the
+ * card. dir_find() in ff.c asks for the offset through ff_dirindex_lookup()
+ * and examines just that entry block, so a lookup costs a bucket read and a
+ * directory sector read.
+ *
+ * FAT keeps no modification time for directories and the card may have been
+ * written elsewhere, so a hint is never trusted: dir_find() checks the name at
+ * the hinted offset and falls back to a full scan when it does not match or
+ * the name is not in the index. After a call that writes, names found by a
+ * full scan or created by dir_register() are added and wrong hints are
+ * removed. The header records the start cluster of the directory; the index
+ * is rebuilt when that no longer matches or when too many hints have gone
+ * stale.
+ *
+ * The hooks run in the middle of FatFs calls, where the sector window is in
+ * use, so they must not call FatFs. When the index is opened we note the
+ * sector at which each of its clusters starts and close it again; the hooks
+ * then read buckets with disk_read() into a buffer of our own, and
+ * _dirindex_end() updates them in place with disk_write().
+ *
+ * Opening the index is itself a lookup in the directory. While the index
+ * file is opened or created, the hooks answer for its name from a small
+ * table of where the indexes of recently used directories have their
+ * entries, so going back to a directory does not scan it for its index.
+ *
+ * The file is a header sector followed by a power-of-two number of bucket
+ * sectors. A name lives in the first bucket with room, probing linearly from
+ * its hash.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "diskio.h"
+#include "dirindex.h"
+#include "io.h"
+
+#ifndef ROM
+#define DIRINDEX_MAGIC 0x50384958 /* "P8IX" */
+#define DIRINDEX_VERSION 1
+#define DIRINDEX_MIN_ENTRIES 256
+#define DIRINDEX_MAX_EVENTS 4
+#define DIRINDEX_MAX_SELVES 8
+#define PREFIX_MAX 256
+
+#define SLOT_EMPTY 0
+#define SLOT_DELETED 1
+#define SLOTS_PER_BUCKET (FF_MAX_SS / sizeof(struct slot))
+#define NO_BUCKET 0xFFFFFFFF
+#define NO_OFS 0xFFFFFFFF
+
+struct header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t sclust;      /* start cluster of the indexed directory */
+  uint32_t nbuckets;
+  uint32_t count;       /* names in the index */
+  uint32_t stale;       /* wrong hints removed since the last rebuild */
+};
+
+struct slot
+{
+  uint32_t hash;        /* SLOT_EMPTY, SLOT_DELETED or a name hash */
+  uint32_t ofs;         /* offset of the entry block in the directory */
+};
+
+struct event
+{
+  FATFS *fs;
+  DWORD sclust;
+  DWORD hash;
+  DWORD ofs;
+  DWORD n_ent;          /* entries examined to find it (0: just created) */
+};
+
+/* Where the entry of a directory's own index file is. */
+struct self
+{
+  FATFS *fs;            /* NULL: unused */
+  WORD id;              /* mount ID of fs */
+  DWORD sclust;         /* start cluster of the directory */
+  DWORD ofs;            /* offset of the index's entry block */
+};
+
+static bool active;             /* between _dirindex_begin() and _dirindex_end() */
+static bool writing;            /* the bracketed call may write to the card */
+static bool probed;             /* prefix has been checked for an index */
+static bool index_open;         /* the fields below describe a usable index */
+static bool built;              /* a build has been tried for prefix */
+static bool dirty;              /* header needs writing back */
+static char prefix[PREFIX_MAX]; /* path of the directory, up to its last separator */
+static FATFS *index_fs;
+static WORD index_id;           /* mount ID of index_fs when opened */
+static LBA_t *index_lba;        /* first sector of each cluster of the file */
+static UINT index_csize;        /* sectors per cluster */
+static struct header header;
+static DWORD bucket_no = NO_BUCKET;
+static struct slot bucket[SLOTS_PER_BUCKET];
+static DWORD hint_hash;
+static struct event found[DIRINDEX_MAX_EVENTS];
+static int nr_found;
+static struct slot stale[DIRINDEX_MAX_EVENTS];
+static int nr_stale;
+static bool self_active;        /* a FatFs call on an index file itself */
+static struct self selves[DIRINDEX_MAX_SELVES];
+static int next_self;
+
+/* FNV-1a over the upper-cased UTF-16 name, to match FatFs' case-insensitive
+   comparison. */
+static DWORD hash_char(DWORD hash, DWORD uni)
+{
+  uni = ff_wtoupper(uni);
+  hash = (hash ^ (uni & 0xff)) * 16777619;
+  return (hash ^ ((uni >> 8) & 0xff)) * 16777619;
+}
+
+static DWORD hash_finish(DWORD hash)
+{
+  return hash <= SLOT_DELETED ? hash + 2 : hash;
+}
+
+static DWORD hash_uni(const WCHAR *name)
+{
+  DWORD hash = 2166136261u;
+  while (*name)
+    hash = hash_char(hash, *name++);
+  return hash_finish(hash);
+}
+
+static DWORD hash_oem(const char *name, size_t len)
+{
+  DWORD hash = 2166136261u;
+  size_t i;
+  for (i = 0; i < len; i++)
+    {
+      BYTE c = name[i];
+      hash = hash_char(hash, c < 0x80 ? c : ff_oem2uni(c, FF_CODE_PAGE));
+    }
+  return hash_finish(hash);
+}
+
+static bool is_index_name(const WCHAR *name)
+{
+  return hash_uni(name) == hash_oem(_DIRINDEX_NAME, sizeof(_DIRINDEX_NAME) - 1);
+}
+
+static struct self *find_self(FATFS *fs, DWORD sclust)
+{
+  int i;
+  for (i = 0; i < DIRINDEX_MAX_SELVES; i++)
+    if (selves[i].fs == fs && selves[i].id == fs->id && selves[i].sclust == sclust)
+      return &selves[i];
+  return NULL;
+}
+
+/* Open or create the index file at path with the hooks looking after its
+   own entry. */
+static FRESULT open_self(FIL *fil, const char *path, BYTE mode)
+{
+  FRESULT res;
+  self_active = true;
+  res = f_open(fil, path, mode);
+  self_active = false;
+  return res;
+}
+
+/* Length of the directory part of path, including the last separator. */
+static size_t prefix_len(const char *path)
+{
+  size_t i, len = 0;
+  for (i = 0; path[i]; i++)
+    if (path[i] == '/' || path[i] == ':')
+      len = i + 1;
+  return len;
+}
+
+static bool same_prefix(const char *path, size_t len)
+{
+  return probed && strncmp(prefix, path, len) == 0 && prefix[len] == '\0';
+}
+
+/* Sector n of the index file. */
+static LBA_t index_sector(DWORD n)
+{
+  return index_lba[n / index_csize] + n % index_csize;
+}
+
+/* Whether the index still belongs to the mounted volume. */
+static bool index_valid(void)
+{
+  return index_open && index_fs->id == index_id;
+}
+
+static FRESULT load_bucket(DWORD b)
+{
+  if (bucket_no == b)
+    return FR_OK;
+  bucket_no = NO_BUCKET;
+  if (disk_read(index_fs->pdrv, (BYTE *)bucket, index_sector(b + 1), 1) != RES_OK)
+    return FR_DISK_ERR;
+  bucket_no = b;
+  return FR_OK;
+}
+
+static FRESULT store_bucket(void)
+{
+  if (disk_write(index_fs->pdrv, (const BYTE *)bucket, index_sector(bucket_no + 1), 1) != RES_OK)
+    return FR_DISK_ERR;
+  return FR_OK;
+}
+
+static FRESULT store_header(void)
+{
+  /* The header sector is the header followed by zeros. */
+  bucket_no = NO_BUCKET;
+  memset(bucket, 0, sizeof(bucket));
+  memcpy(bucket, &header, sizeof(header));
+  dirty = false;
+  if (disk_write(index_fs->pdrv, (const BYTE *)bucket, index_sector(0), 1) != RES_OK)
+    return FR_DISK_ERR;
+  return FR_OK;
+}
+
+/* Add hash -> ofs unless it is already there. */
+static FRESULT insert(DWORD hash, DWORD ofs)
+{
+  FRESULT res;
+  DWORD probe, b, free_b = NO_BUCKET;
+  UINT i, free_i = 0;
+  bool end = false;
+  for (probe = 0; probe < header.nbuckets && !end; probe++)
+    {
+      b = (hash + probe) & (header.nbuckets - 1);
+      res = load_bucket(b);
+      if (res != FR_OK)
+        return res;
+      for (i = 0; i < SLOTS_PER_BUCKET && !end; i++)
+        {
+          if (bucket[i].hash == hash && bucket[i].ofs == ofs)
+            return FR_OK;
+          if (bucket[i].hash <= SLOT_DELETED && free_b == NO_BUCKET)
+            {
+              free_b = b;
+              free_i = i;
+            }
+          end = bucket[i].hash == SLOT_EMPTY;
+        }
+    }
+  if (free_b == NO_BUCKET)
+    return FR_DENIED;
+  res = load_bucket(free_b);
+  if (res != FR_OK)
+    return res;
+  bucket[free_i].hash = hash;
+  bucket[free_i].ofs = ofs;
+  header.count++;
+  dirty = true;
+  return store_bucket();
+}
+
+/* Remove hash -> ofs, or every slot for hash if ofs is NO_OFS. */
+static FRESULT remove_slots(DWORD hash, DWORD ofs)
+{
+  FRESULT res;
+  DWORD probe, b;
+  UINT i;
+  bool end = false, changed;
+  for (probe = 0; probe < header.nbuckets && !end; probe++)
+    {
+      b = (hash + probe) & (header.nbuckets - 1);
+      res = load_bucket(b);
+      if (res != FR_OK)
+        return res;
+      changed = false;
+      for (i = 0; i < SLOTS_PER_BUCKET && !end; i++)
+        {
+          if (bucket[i].hash == hash && (ofs == NO_OFS || bucket[i].ofs == ofs))
+            {
+              bucket[i].hash = SLOT_DELETED;
+              header.count--;
+              changed = true;
+            }
+          end = bucket[i].hash == SLOT_EMPTY;
+        }
+      if (changed)
+        {
+          dirty = true;
+          res = store_bucket();
+          if (res != FR_OK)
+            return res;
+        }
+    }
+  return FR_OK;
+}
+
+static void close_index(void)
+{
+  if (index_valid() && dirty)
+    store_header();
+  free(index_lba);
+  index_lba = NULL;
+  index_open = false;
+  dirty = false;
+  bucket_no = NO_BUCKET;
+}
+
+static void index_path(char *path)
+{
+  strcpy(path, prefix);
+  strcat(path, _DIRINDEX_NAME);
+}
+
+static void open_index(void)
+{
+  char path[PREFIX_MAX + sizeof(_DIRINDEX_NAME)];
+  FIL fil;
+  FSIZE_t size, bcs;
+  DWORD ncl, i;
+  bool ok;
+
+  index_path(path);
+  if (open_self(&fil, path, FA_READ) != FR_OK)
+    return;
+  index_fs = fil.obj.fs;
+  index_id = index_fs->id;
+  index_csize = index_fs->csize;
+  size = f_size(&fil);
+  bcs = (FSIZE_t)index_csize * FF_MAX_SS;
+  ncl = (size + bcs - 1) / bcs;
+  ok = size >= 2 * FF_MAX_SS && size % FF_MAX_SS == 0;
+  if (ok)
+    index_lba = malloc(ncl * sizeof(LBA_t));
+  ok = ok && index_lba != NULL;
+  /* Seeking one byte into a cluster leaves its first sector in fil.sect. */
+  for (i = 0; ok && i < ncl; i++)
+    {
+      ok = f_lseek(&fil, i * bcs + 1) == FR_OK && fil.sect != 0;
+      if (ok)
+        index_lba[i] = fil.sect;
+    }
+  f_close(&fil);
+  ok = ok && disk_read(index_fs->pdrv, (BYTE *)bucket, index_lba[0], 1) == RES_OK;
+  if (ok)
+    {
+      memcpy(&header, bucket, sizeof(header));
+      ok = header.magic == DIRINDEX_MAGIC
+        && header.version == DIRINDEX_VERSION
+        && header.nbuckets != 0
+        && (header.nbuckets & (header.nbuckets - 1)) == 0
+        && size == (FSIZE_t)(header.nbuckets + 1) * FF_MAX_SS;
+    }
+  if (!ok)
+    {
+      free(index_lba);
+      index_lba = NULL;
+      return;
+    }
+  index_open = true;
+}
+
+/* Write a fresh index for the directory at prefix, which should start at
+   sclust. */
+static FRESULT build(DWORD sclust)
+{
+  FRESULT res;
+  DIR dj;
+  FILINFO info;
+  char path[PREFIX_MAX + sizeof(_DIRINDEX_NAME)];
+  size_t len;
+  struct slot *table = NULL;
+  FIL fil;
+  DWORD ofs, hash, b, count = 0, nbuckets = 1;
+  UINT i, bw;
+
+  close_index();
+  built = true;
+
+  /* f_opendir() wants the directory without a trailing separator, except
+     for the root. */
+  strcpy(path, prefix);
+  len = strlen(path);
+  if (len > 1 && path[len - 1] == '/' && path[len - 2] != ':')
+    path[len - 1] = '\0';
+  res = f_opendir(&dj, path);
+  if (res != FR_OK)
+    return res;
+  if (dj.obj.sclust != sclust)
+    {
+      f_closedir(&dj);
+      return FR_NO_PATH;
+    }
+  while ((res = ff_dirindex_read(&dj, &info, &ofs)) == FR_OK && info.fname[0])
+    count++;
+  if (res == FR_OK)
+    {
+      /* Keep the buckets at most half full. */
+      while (nbuckets * SLOTS_PER_BUCKET < count * 2)
+        nbuckets <<= 1;
+      table = calloc(nbuckets, FF_MAX_SS);
+      if (table == NULL)
+        res = FR_NOT_ENOUGH_CORE;
+    }
+  if (res == FR_OK)
+    res = f_readdir(&dj, NULL);
+  count = 0;
+  while (res == FR_OK
+         && (res = ff_dirindex_read(&dj, &info, &ofs)) == FR_OK && info.fname[0])
+    {
+      if (strcmp(info.fname, _DIRINDEX_NAME) == 0)
+        continue;
+      hash = hash_oem(info.fname, strlen(info.fname));
+      for (b = hash & (nbuckets - 1);; b = (b + 1) & (nbuckets - 1))
+        {
+          for (i = 0; i < SLOTS_PER_BUCKET && table[b * SLOTS_PER_BUCKET + i].hash; i++)
+            ;
+          if (i < SLOTS_PER_BUCKET)
+            break;
+        }
+      table[b * SLOTS_PER_BUCKET + i].hash = hash;
+      table[b * SLOTS_PER_BUCKET + i].ofs = ofs;
+      count++;
+    }
+  f_closedir(&dj);
+
+  if (res == FR_OK)
+    {
+      index_path(path);
+      res = open_self(&fil, path, FA_CREATE_ALWAYS | FA_WRITE);
+    }
+  if (res == FR_OK)
+    {
+      header.magic = DIRINDEX_MAGIC;
+      header.version = DIRINDEX_VERSION;
+      header.sclust = sclust;
+      header.nbuckets = nbuckets;
+      header.count = count;
+      header.stale = 0;
+      memset(bucket, 0, sizeof(bucket));
+      memcpy(bucket, &header, sizeof(header));
+      res = f_write(&fil, bucket, FF_MAX_SS, &bw);
+      if (res == FR_OK)
+        res = f_write(&fil, table, nbuckets * FF_MAX_SS, &bw);
+      if (f_close(&fil) == FR_OK && res == FR_OK)
+        {
+          f_chmod(path, AM_HID | AM_SYS, AM_HID | AM_SYS);
+          open_index();
+          if (!index_open)
+            res = FR_INT_ERR;
+        }
+      else
+        f_unlink(path);
+    }
+  free(table);
+  return res;
+}
+
+DWORD ff_dirindex_lookup(FATFS *fs, DWORD sclust, const WCHAR *name)
+{
+  DWORD hash, probe, b;
+  UINT i;
+  struct self *self;
+  if (self_active)
+    {
+      self = find_self(fs, sclust);
+      return self != NULL && is_index_name(name) ? self->ofs : 0xFFFFFFFF;
+    }
+  if (!active || !index_valid() || fs != index_fs || sclust != header.sclust)
+    return 0xFFFFFFFF;
+  hash = hash_uni(name);
+  for (probe = 0; probe < header.nbuckets; probe++)
+    {
+      b = (hash + probe) & (header.nbuckets - 1);
+      if (load_bucket(b) != FR_OK)
+        return 0xFFFFFFFF;
+      for (i = 0; i < SLOTS_PER_BUCKET; i++)
+        {
+          if (bucket[i].hash == hash)
+            {
+              hint_hash = hash;
+              return bucket[i].ofs;
+            }
+          if (bucket[i].hash == SLOT_EMPTY)
+            return 0xFFFFFFFF;
+        }
+    }
+  return 0xFFFFFFFF;
+}
+
+void ff_dirindex_stale(FATFS *fs, DWORD sclust, DWORD ofs)
+{
+  struct self *self;
+  if (self_active)
+    {
+      self = find_self(fs, sclust);
+      if (self != NULL)
+        self->fs = NULL;
+      return;
+    }
+  if (nr_stale < DIRINDEX_MAX_EVENTS)
+    {
+      stale[nr_stale].hash = hint_hash;
+      stale[nr_stale].ofs = ofs;
+      nr_stale++;
+    }
+}
+
+void ff_dirindex_found(FATFS *fs, DWORD sclust, const WCHAR *name, DWORD ofs, DWORD n_ent)
+{
+  struct event *ev;
+  struct self *self;
+  if (self_active)
+    {
+      if (!is_index_name(name))
+        return;
+      self = find_self(fs, sclust);
+      if (self == NULL)
+        {
+          self = &selves[next_self];
+          next_self = (next_self + 1) % DIRINDEX_MAX_SELVES;
+        }
+      self->fs = fs;
+      self->id = fs->id;
+      self->sclust = sclust;
+      self->ofs = ofs;
+      return;
+    }
+  if (!active)
+    return;
+  /* Only the most recent events matter: the last path components. */
+  if (nr_found == DIRINDEX_MAX_EVENTS)
+    {
+      memmove(found, found + 1, sizeof(found) - sizeof(found[0]));
+      nr_found--;
+    }
+  ev = &found[nr_found++];
+  ev->fs = fs;
+  ev->sclust = sclust;
+  ev->hash = hash_uni(name);
+  ev->ofs = ofs;
+  ev->n_ent = n_ent;
+}
+
+/* Start a FatFs call on path. Only if write is set may _dirindex_end()
+   update or build the index. */
+void _dirindex_begin(const char *path, int write)
+{
+  size_t len = prefix_len(path);
+  nr_found = 0;
+  nr_stale = 0;
+  if (len >= PREFIX_MAX)
+    return;
+  if (index_open && !index_valid())
+    {
+      /* Remounted: look again. */
+      close_index();
+      probed = false;
+    }
+  if (!same_prefix(path, len))
+    {
+      close_index();
+      memcpy(prefix, path, len);
+      prefix[len] = '\0';
+      probed = true;
+      built = false;
+      open_index();
+    }
+  writing = write;
+  active = true;
+}
+
+void _dirindex_end(void)
+{
+  struct event *last;
+  bool rebuild = false;
+  int i;
+
+  if (!active)
+    return;
+  active = false;
+  if (!writing)
+    return;
+  last = nr_found ? &found[nr_found - 1] : NULL;
+
+  if (index_valid())
+    {
+      for (i = 0; i < nr_stale; i++)
+        {
+          if (remove_slots(stale[i].hash, stale[i].ofs) != FR_OK)
+            break;
+          header.stale++;
+        }
+      for (i = 0; i < nr_found; i++)
+        {
+          if (found[i].fs != index_fs || found[i].sclust != header.sclust)
+            continue;
+          if (insert(found[i].hash, found[i].ofs) != FR_OK)
+            {
+              rebuild = true;
+              break;
+            }
+        }
+      if (header.stale > header.count / 4 + 16
+          || header.count > header.nbuckets * SLOTS_PER_BUCKET * 3 / 4)
+        rebuild = true;
+      /* A big directory with an index for something else: most likely the
+         directory was deleted and made again. */
+      if (last && last->n_ent >= DIRINDEX_MIN_ENTRIES
+          && (last->fs != index_fs || last->sclust != header.sclust))
+        rebuild = true;
+      if (rebuild)
+        build(last && last->n_ent >= DIRINDEX_MIN_ENTRIES ? last->sclust : header.sclust);
+      else if (dirty)
+        store_header();
+    }
+  else if (last && last->n_ent >= DIRINDEX_MIN_ENTRIES && !built)
+    build(last->sclust);
+}
+
+void _dirindex_unlinked(const char *path)
+{
+  size_t len = prefix_len(path), n;
+  if (!index_valid() || !same_prefix(path, len))
+    return;
+  n = strlen(path + len);
+  while (n > 0 && (path[len + n - 1] == '.' || path[len + n - 1] == ' '))
+    n--;
+  remove_slots(hash_oem(path + len, n), NO_OFS);
+  if (dirty)
+    store_header();
+}
+
+/* Build a fresh index for the directory at dirpath. */
+FRESULT _dirindex_build(const char *dirpath)
+{
+  DIR dj;
+  FRESULT res;
+  size_t len = strlen(dirpath);
+  if (len + 1 >= PREFIX_MAX)
+    return FR_INVALID_NAME;
+  res = f_opendir(&dj, dirpath);
+  if (res != FR_OK)
+    return res;
+  f_closedir(&dj);
+  close_index();
+  strcpy(prefix, dirpath);
+  if (len > 0 && dirpath[len - 1] != '/' && dirpath[len - 1] != ':')
+    strcat(prefix, "/");
+  probed = true;
+  return build(dj.obj.sclust);
+}
+
+int _dirindex_drop(const char *dirpath)
+{
+  char path[PREFIX_MAX + sizeof(_DIRINDEX_NAME) + 1];
+  size_t len = strlen(dirpath);
+  if (len + 1 >= PREFIX_MAX)
+    return -1;
+  close_index();
+  probed = false;
+  strcpy(path, dirpath);
+  if (len > 0 && dirpath[len - 1] != '/' && dirpath[len - 1] != ':')
+    strcat(path, "/");
+  strcat(path, _DIRINDEX_NAME);
+  return f_unlink(path) == FR_OK ? 0 : -1;
+}
+#endif
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+#ifndef DIRINDEX_H
+#define DIRINDEX_H
+
+/* Per-directory lookup index kept in a hidden file next to the entries it
+   indexes. See dirindex.c. */
+
+#define _DIRINDEX_NAME ".p8index"
+
+#ifndef ROM
+/* Bracket every FatFs call that looks up or creates a path; write is set
+   for calls that may change the directory. */
+extern void _dirindex_begin(const char *path, int write);
+extern void _dirindex_end(void);
+/* Build the index of a directory now. */
+extern FRESULT _dirindex_build(const char *dirpath);
+/* Forget a name that has just been removed from its directory. */
+extern void _dirindex_unlinked(const char *path);
+/* Delete the index of a directory that is about to be removed. */
+extern int _dirindex_drop(const char *dirpath);
+#endif
+
+#endif
@@ -22,6 +22,7 @@
 
 #include "ff.h"
 #include "diskio.h"
+#include "disk.h"
 #include "nextp8.h"
 #include "sdblockdevice.h"
 
@@ -52,6 +53,28 @@ static struct cache_entry cache[CACHE_NUM_SETS][CACHE_NUM_WAYS];
 static unsigned int global_lru_counter = 0;
 static bool cache_initialized = false;
 
+/* While an unbuffered transfer is in progress, misses on sectors at or
+ * above uncached_start on uncached_pdrv are not allocated in the cache, so
+ * bulk data does not evict FAT and directory sectors. */
+static bool uncached;
+static BYTE uncached_pdrv;
+static LBA_t uncached_start;
+
+#define TRIM_QUEUE_SIZE     16
+
+struct trim_range {
+    BYTE pdrv;
+    LBA_t start;
+    LBA_t end;          /* inclusive */
+};
+
+/* Freed sector ranges waiting to be erased. Erasing is slow, so instead of
+ * erasing inside unlink() the ranges are merged here and erased at the next
+ * sync point (see _disk_flush_trim()). Writing to a queued range takes the
+ * written sectors out of it. */
+static struct trim_range trim_queue[TRIM_QUEUE_SIZE];
+static int trim_count;
+
 static bool cache_intialize(sd_size_t sector_size)
 {
     bool alloc_success = true;
@@ -141,25 +164,23 @@ DSTATUS disk_initialize (
 }
 
 #ifndef ROM
-static DRESULT disk_read_sector (
+static struct cache_entry *cache_fill (
   BYTE pdrv,     /* [IN] Physical drive number */
-  BYTE* buff,    /* [OUT] Pointer to the read data buffer (sector_size bytes) */
   LBA_t sector   /* [IN] Sector number */
 )
 {
     sd_size_t sector_size = _sd_get_read_size(&sd[pdrv]);
 
     if (!cache_initialized)
-        return RES_ERROR;
+        return NULL;
 
     unsigned int set = sector & CACHE_SET_MASK;
 
     for (int way = 0; way < CACHE_NUM_WAYS; way++) {
         struct cache_entry *entry = &cache[set][way];
         if (entry->valid && entry->pdrv == pdrv && entry->sector == sector) {
-            memcpy(buff, entry->data, sector_size);
             entry->lru_counter = ++global_lru_counter;
-            return RES_OK;
+            return entry;
         }
     }
 
@@ -177,12 +198,13 @@ static DRESULT disk_read_sector (
     }
 
     struct cache_entry *entry = &cache[set][lru_way];
+    entry->valid = false;
     int res = _sd_read(&sd[pdrv], entry->data,
                        (sd_size_t)sector * sector_size,
                        (sd_size_t)sector_size);
     if (res != SD_BLOCK_DEVICE_OK) {
         fprintf(stderr, "_sd_read: error %d\n", res);
-        return RES_ERROR;
+        return NULL;
     }
 
     entry->valid = true;
@@ -190,10 +212,144 @@ static DRESULT disk_read_sector (
     entry->sector = sector;
     entry->lru_counter = ++global_lru_counter;
 
-    memcpy(buff, entry->data, sector_size);
+    return entry;
+}
+
+static DRESULT disk_read_sector (
+  BYTE pdrv,     /* [IN] Physical drive number */
+  BYTE* buff,    /* [OUT] Pointer to the read data buffer (sector_size bytes) */
+  LBA_t sector   /* [IN] Sector number */
+)
+{
+    sd_size_t sector_size = _sd_get_read_size(&sd[pdrv]);
 
+    if (uncached && pdrv == uncached_pdrv && sector >= uncached_start) {
+        unsigned int set = sector & CACHE_SET_MASK;
+        for (int way = 0; way < CACHE_NUM_WAYS; way++) {
+            struct cache_entry *entry = &cache[set][way];
+            if (entry->valid && entry->pdrv == pdrv && entry->sector == sector) {
+                memcpy(buff, entry->data, sector_size);
+                return RES_OK;
+            }
+        }
+        int res = _sd_read(&sd[pdrv], buff,
+                           (sd_size_t)sector * sector_size,
+                           sector_size);
+        if (res != SD_BLOCK_DEVICE_OK) {
+            fprintf(stderr, "_sd_read: error %d\n", res);
+            return RES_ERROR;
+        }
+        return RES_OK;
+    }
+
+    struct cache_entry *entry = cache_fill(pdrv, sector);
+    if (entry == NULL)
+        return RES_ERROR;
+    memcpy(buff, entry->data, sector_size);
     return RES_OK;
 }
+
+/* Return the cache buffer holding a sector, reading it in on a miss.
+ * The buffer is only valid until the next disk access. */
+const BYTE *_disk_cache_sector (
+  BYTE pdrv,     /* [IN] Physical drive number */
+  LBA_t sector   /* [IN] Sector number */
+)
+{
+    if (pdrv < 0 || pdrv > 1 || !sd_initialized[pdrv])
+        return NULL;
+    struct cache_entry *entry = cache_fill(pdrv, sector);
+    return entry ? entry->data : NULL;
+}
+
+void _disk_begin_uncached(BYTE pdrv, LBA_t first_sector)
+{
+    uncached = true;
+    uncached_pdrv = pdrv;
+    uncached_start = first_sector;
+}
+
+void _disk_end_uncached(void)
+{
+    uncached = false;
+}
+
+/* Erase the whole erase blocks inside range. The sectors around them are
+ * left alone: small frees and SDSC cards with large erase blocks often have
+ * none to erase. Erasing is only a hint to the card, so failures are
+ * returned rather than reported on stderr, which the console shows. */
+static int trim_issue(const struct trim_range *range)
+{
+    sd_size_t sector_size = _sd_get_read_size(&sd[range->pdrv]);
+    LBA_t erase_sectors = _sd_get_erase_size(&sd[range->pdrv]) / sector_size;
+    LBA_t start = range->start, end = range->end + 1;
+    if (erase_sectors > 1) {
+        start = (start + erase_sectors - 1) / erase_sectors * erase_sectors;
+        end = end / erase_sectors * erase_sectors;
+    }
+    if (start >= end)
+        return SD_BLOCK_DEVICE_OK;
+    return _sd_trim(&sd[range->pdrv],
+                    (sd_size_t)start * sector_size,
+                    (sd_size_t)(end - start) * sector_size);
+}
+
+static void trim_append(BYTE pdrv, LBA_t start, LBA_t end)
+{
+    if (trim_count == TRIM_QUEUE_SIZE)
+        _disk_flush_trim();
+    trim_queue[trim_count].pdrv = pdrv;
+    trim_queue[trim_count].start = start;
+    trim_queue[trim_count].end = end;
+    trim_count++;
+}
+
+static void trim_queue_range(BYTE pdrv, LBA_t start, LBA_t end)
+{
+    /* Absorb every queued range that overlaps or touches this one. */
+    for (int i = 0; i < trim_count;) {
+        struct trim_range *range = &trim_queue[i];
+        if (range->pdrv == pdrv && range->start <= end + 1 && start <= range->end + 1) {
+            if (range->start < start)
+                start = range->start;
+            if (range->end > end)
+                end = range->end;
+            *range = trim_queue[--trim_count];
+        } else {
+            i++;
+        }
+    }
+    trim_append(pdrv, start, end);
+}
+
+/* Sectors about to be written must not be erased afterwards. */
+static void trim_cancel(BYTE pdrv, LBA_t start, LBA_t end)
+{
+    for (int i = 0; i < trim_count;) {
+        struct trim_range range = trim_queue[i];
+        if (range.pdrv == pdrv && range.start <= end && start <= range.end) {
+            trim_queue[i] = trim_queue[--trim_count];
+            if (range.start < start)
+                trim_append(pdrv, range.start, start - 1);
+            if (range.end > end)
+                trim_append(pdrv, end + 1, range.end);
+        } else {
+            i++;
+        }
+    }
+}
+
+/* Erase every queued range. Called on close(), on exit and from
+ * _fatfs_idle(). Returns 0, or -1 if the card refused an erase. */
+int _disk_flush_trim(void)
+{
+    int ret = 0;
+    for (int i = 0; i < trim_count; i++)
+        if (trim_issue(&trim_queue[i]) != SD_BLOCK_DEVICE_OK)
+            ret = -1;
+    trim_count = 0;
+    return ret;
+}
 #endif
 
 DRESULT disk_read (
@@ -242,6 +398,10 @@ DRESULT disk_write (
 {
     if (pdrv < 0 || pdrv > 1 || !sd_initialized[pdrv])
         return RES_NOTRDY;
+#ifndef ROM
+    if (trim_count > 0)
+        trim_cancel(pdrv, sector, sector + count - 1);
+#endif
     sd_size_t sector_size = _sd_get_read_size(&sd[pdrv]);
     int res = _sd_program(&sd[pdrv], buff,
                           (sd_size_t)sector * sector_size,
@@ -278,7 +438,8 @@ DRESULT disk_ioctl (
         return RES_NOTRDY;
     switch (cmd) {
     case CTRL_SYNC:
-        /* No write cache so nothing to sync */
+        /* No write cache so nothing to sync. FatFs also syncs at the end
+           of f_unlink(), so queued trims are left for _disk_flush_trim(). */
         return RES_OK;
     case GET_SECTOR_COUNT:
         *(LBA_t *)buff = _sd_size(&sd[pdrv]) / _sd_get_read_size(&sd[pdrv]);
@@ -286,14 +447,23 @@ DRESULT disk_ioctl (
     case GET_SECTOR_SIZE:
         *(WORD *)buff = _sd_get_read_size(&sd[pdrv]);
         return RES_OK;
-    case GET_BLOCK_SIZE:
-        *(DWORD *)buff = _sd_get_program_size(&sd[pdrv]);
+    case GET_BLOCK_SIZE: {
+        /* Erase block size in sectors: the card's allocation unit */
+        DWORD au_sectors = _sd_get_au_size(&sd[pdrv]) / _sd_get_read_size(&sd[pdrv]);
+        *(DWORD *)buff = au_sectors ? au_sectors : 1;
         return RES_OK;
+    }
     case CTRL_TRIM: {
+        /* buff holds the first and last sector of the freed range */
+        LBA_t *range = (LBA_t *)buff;
+#ifdef ROM
         sd_size_t sector_size = _sd_get_read_size(&sd[pdrv]);
         _sd_trim(&sd[pdrv],
-                 (sd_size_t)((LBA_t *)buff)[0] * sector_size,
-                 (sd_size_t)((LBA_t *)buff)[1] * sector_size);
+                 (sd_size_t)range[0] * sector_size,
+                 (sd_size_t)(range[1] - range[0] + 1) * sector_size);
+#else
+        trim_queue_range(pdrv, range[0], range[1]);
+#endif
         return RES_OK;
     }
     default:
@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+#ifndef DISK_H
+#define DISK_H
+
+#include "ff.h"
+
+/* BSP extensions to the FatFs disk interface in disk.c. */
+
+#ifndef ROM
+extern const BYTE *_disk_cache_sector(BYTE pdrv, LBA_t sector);
+extern void _disk_begin_uncached(BYTE pdrv, LBA_t first_sector);
+extern void _disk_end_uncached(void);
+extern int _disk_flush_trim(void);
+#endif
+
+#endif
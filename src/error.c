@@ -29,6 +29,9 @@ static void _show_message_common(enum message_type message_type, const char *mes
 {
   _uart_write(message, strlen(message));
   _uart_write("\n", 1);
+#ifndef ROM
+  _uart_flush();
+#endif
 
   if (_config_data && _config_data->exit_action == 1)
     return;
@@ -76,6 +79,8 @@ void __attribute__ ((noreturn)) _fatal_error(const char *format, ...)
   char message[256];
   vsnprintf(message, sizeof(message), format, ap);
   va_end(ap);
+  _trace_flush();
+  _log_flush_all();
 #endif
   _show_message_common(FATAL_ERROR, message);
   if (_config_data && _config_data->exit_action == 1)
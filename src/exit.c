@@ -15,9 +15,14 @@
  */
 
 #include <stdlib.h>
+#ifndef ROM
+#include "disk.h"
+#endif
 #include "nextp8.h"
 
-char *last_error = NULL;
+#ifndef ROM
+#define LAST_ERROR_LINES 4
+#endif
 
 /*
  * _exit -- Exit from the application.
@@ -25,12 +30,21 @@ char *last_error = NULL;
 
 void __attribute__ ((noreturn)) _exit (int code)
 {
+#ifndef ROM
+  _trace_flush();
+  _log_flush_all();
+  _console_flush();
+  _disk_flush_trim();
+  _uart_flush();
+#endif
   if (code != 0)
     {
-      if (last_error)
-        _fatal_error(last_error);
-      else
-        _fatal_error("fatal error");
+#ifndef ROM
+      char last_error[256];
+      if (_stderr_tail(last_error, sizeof(last_error), LAST_ERROR_LINES) > 0)
+        _fatal_error("%s", last_error);
+#endif
+      _fatal_error("fatal error");
     }
   else
     {
@@ -9,8 +9,12 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include "ff.h"
+#include "dirindex.h"
+#include "disk.h"
 #include "io.h"
 #include "nextp8.h"
 
@@ -67,6 +71,10 @@ int fresult2errno(FRESULT fr) {
     }
 }
 
+#ifndef ROM
+#define FATFS_IDLE_FAT_SECTORS 16
+#endif
+
 static int fatfs_initialized;
 static FATFS fs[2];
 static const char *volume_names[2] = {"0:", "1:"};
@@ -104,6 +112,90 @@ void _init_fatfs(void)
     }
 }
 
+#ifndef ROM
+/* Read up to max_sectors more of each volume's FAT into its free cluster map.
+   Returns 1 once every map is complete. */
+int _fatfs_freemap_build(unsigned max_sectors)
+{
+  int done = 1;
+  _init_fatfs();
+  for (int i=0;i<2;++i)
+    {
+      if (fs[i].fs_type == 0)
+        continue;
+      if (_freemap_build(&fs[i], max_sectors) == 0)
+        done = 0;
+    }
+  return done;
+}
+
+/* File system housekeeping for idle moments: erase the blocks freed since
+   the last sync point and read a little more of the FAT into the free
+   cluster map. Does nothing until something else has mounted the card, so
+   programs that do not use it run without one. _idle() calls this. */
+void _fatfs_idle(void)
+{
+  if (!fatfs_initialized)
+    return;
+  _disk_flush_trim();
+  _fatfs_freemap_build(FATFS_IDLE_FAT_SECTORS);
+}
+
+/* Find a contiguous, erase block aligned area of size bytes for a newly
+   created, still empty file. This is a hint, not a reservation: nothing is
+   allocated, and FatFs takes the file's clusters from the start of the area
+   as it is written. The file stays contiguous unless another file grows in
+   the meantime. Reserving the clusters outright (f_expand() with opt 1)
+   would give the file its full size at once, with stale data past whatever
+   is written. */
+int _fatfs_preallocate(int fd, off_t size)
+{
+  FRESULT res;
+  struct _file *file = _get_file(fd);
+  if (file == NULL)
+    return -1;
+  if (file->ops != &_fatfs_ops)
+    {
+      errno = ENODEV;
+      return -1;
+    }
+  if (!(file->fil.flag & FA_WRITE))
+    {
+      errno = EBADF;
+      return -1;
+    }
+  if (size <= 0 || f_size(&file->fil) != 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  res = f_expand(&file->fil, size, 0);
+  if (res != FR_OK)
+    {
+      /* FR_DENIED: no contiguous area that big */
+      errno = (res == FR_DENIED) ? ENOSPC : fresult2errno(res);
+      return -1;
+    }
+  return 0;
+}
+
+/* Build the lookup index of a large directory, such as a cart library, so
+   that later lookups there read one bucket instead of scanning it. Lookups
+   that only read never build one themselves. */
+int _fatfs_index_dir(const char *path)
+{
+  FRESULT res;
+  _init_fatfs();
+  res = _dirindex_build(path);
+  if (res != FR_OK)
+    {
+      errno = fresult2errno(res);
+      return -1;
+    }
+  return 0;
+}
+#endif
+
 int _fatfs_access(const char *pathname, int mode)
 {
 #ifdef ROM
@@ -112,7 +204,9 @@ int _fatfs_access(const char *pathname, int mode)
 #else
   FRESULT res;
   FILINFO info;
+  _dirindex_begin(pathname, 0);
   res = f_stat(pathname, &info);
+  _dirindex_end();
   if (res != FR_OK)
     {
       errno = fresult2errno(res);
@@ -126,6 +220,9 @@ static int fatfs_close(struct _file *file)
 {
   FRESULT res;
   res = f_close(&file->fil);
+#ifndef ROM
+  _disk_flush_trim();
+#endif
   if (res != FR_OK)
     {
       errno = fresult2errno(res);
@@ -179,7 +276,10 @@ int _fatfs_mkdir(const char *pathname, mode_t mode)
   errno = ENOSYS;
   return -1;
 #else
-  FRESULT res = f_mkdir(pathname);
+  FRESULT res;
+  _dirindex_begin(pathname, 1);
+  res = f_mkdir(pathname);
+  _dirindex_end();
   if (res != FR_OK)
     {
       errno = fresult2errno(res);
@@ -220,7 +320,19 @@ static ssize_t fatfs_read(struct _file *file, void *buf, size_t count)
 {
   FRESULT res;
   unsigned bytes_read = 0;
+#ifndef ROM
+  if (file->flags & _O_DIRECT)
+    {
+      FATFS *fs = file->fil.obj.fs;
+      _disk_begin_uncached(fs->pdrv, fs->database);
+      res = f_read(&file->fil, buf, count, &bytes_read);
+      _disk_end_uncached();
+    }
+  else
+    res = f_read(&file->fil, buf, count, &bytes_read);
+#else
   res = f_read(&file->fil, buf, count, &bytes_read);
+#endif
   if (res != FR_OK)
     {
 #ifdef ROM
@@ -244,7 +356,10 @@ struct dirent *_fatfs_readdir(DIR *dirp)
     dirent->d_attrib = AM_DIR;
     return dirent;
   }
-  FRESULT res = f_readdir(dirp, (FILINFO *)dirent);
+  FRESULT res;
+  do
+    res = f_readdir(dirp, (FILINFO *)dirent);
+  while (res == FR_OK && strcmp(dirent->d_name, _DIRINDEX_NAME) == 0);
   if (res != FR_OK)
     {
       errno = fresult2errno(res);
@@ -256,6 +371,111 @@ struct dirent *_fatfs_readdir(DIR *dirp)
 #endif
 }
 
+#ifndef ROM
+static int readdir_batch_flags;
+
+static int dirent_entry_compare(const void *a, const void *b)
+{
+  const struct _dirent_entry *ea = a;
+  const struct _dirent_entry *eb = b;
+  if (readdir_batch_flags & _READDIR_DIRS_FIRST)
+    {
+      int a_dir = (ea->d_attrib & AM_DIR) != 0;
+      int b_dir = (eb->d_attrib & AM_DIR) != 0;
+      if (a_dir != b_dir)
+        return b_dir - a_dir;
+    }
+  return strcasecmp(ea->d_name, eb->d_name);
+}
+
+int _match_ext(const char *name, const char *ext)
+{
+  size_t name_len = strlen(name);
+  size_t ext_len;
+  if (*ext == '.')
+    ext++;
+  ext_len = strlen(ext);
+  if (name_len <= ext_len || name[name_len - ext_len - 1] != '.')
+    return 0;
+  return strcasecmp(name + name_len - ext_len, ext) == 0;
+}
+
+void _sort_dirent_entries(struct _dirent_entry *entries, int n, int flags)
+{
+  if ((flags & _READDIR_SORT) && n > 1)
+    {
+      readdir_batch_flags = flags;
+      qsort(entries, n, sizeof(*entries), dirent_entry_compare);
+    }
+}
+#endif
+
+int _fatfs_readdir_batch(DIR *dirp, struct _dirent_entry *entries, int max_entries,
+                         char *names, size_t names_size, const char *ext, int flags)
+{
+#ifdef ROM
+  errno = ENOSYS;
+  return -1;
+#else
+  struct dirent *dirent = (struct dirent *)(dirp + 1);
+  int n = 0;
+  if (dirent->d_name[0] == '\0')
+    {
+      strcpy(dirent->d_name, "..");
+      if (!(flags & _READDIR_NO_DOTDOT) && max_entries > 0)
+        {
+          entries[n].d_name = "..";
+          entries[n].d_size = 0;
+          entries[n].d_date = 0;
+          entries[n].d_time = 0;
+          entries[n].d_attrib = AM_DIR;
+          n++;
+        }
+    }
+  while (n < max_entries)
+    {
+      DIR saved = *dirp;
+      FILINFO info;
+      size_t len;
+      FRESULT res = f_readdir(dirp, &info);
+      if (res != FR_OK)
+        {
+          if (n > 0)
+            break;
+          errno = fresult2errno(res);
+          return -1;
+        }
+      if (info.fname[0] == '\0')
+        break;
+      if (strcmp(info.fname, _DIRINDEX_NAME) == 0)
+        continue;
+      if (ext && !(info.fattrib & AM_DIR) && !_match_ext(info.fname, ext))
+        continue;
+      len = strlen(info.fname) + 1;
+      if (len > names_size)
+        {
+          /* Leave the entry for the next call. */
+          *dirp = saved;
+          if (n > 0)
+            break;
+          errno = EINVAL;
+          return -1;
+        }
+      memcpy(names, info.fname, len);
+      entries[n].d_name = names;
+      entries[n].d_size = info.fsize;
+      entries[n].d_date = info.fdate;
+      entries[n].d_time = info.ftime;
+      entries[n].d_attrib = info.fattrib;
+      names += len;
+      names_size -= len;
+      n++;
+    }
+  _sort_dirent_entries(entries, n, flags);
+  return n;
+#endif
+}
+
 int _fatfs_rename (const char *oldpath, const char *newpath)
 {
 #ifdef ROM
@@ -263,12 +483,15 @@ int _fatfs_rename (const char *oldpath, const char *newpath)
   return -1;
 #else
   FRESULT res;
+  _dirindex_begin(oldpath, 1);
   res = f_rename(oldpath, newpath);
+  _dirindex_end();
   if (res != FR_OK)
     {
       errno = fresult2errno(res);
       return -1;
     }
+  _dirindex_unlinked(oldpath);
   return 0;
 #endif
 }
@@ -281,7 +504,9 @@ int _fatfs_stat (const char *__restrict filename, struct stat *__restrict buf)
 #else
   FRESULT res;
   FILINFO info;
+  _dirindex_begin(filename, 0);
   res = f_stat(filename, &info);
+  _dirindex_end();
   if (res != FR_OK)
     {
       errno = fresult2errno(res);
@@ -304,6 +529,26 @@ int _fatfs_stat (const char *__restrict filename, struct stat *__restrict buf)
 #endif
 }
 
+#ifndef ROM
+/* Whether path is a directory that holds nothing but its index: 1 if so,
+   0 if it holds anything else, -1 if it is not a directory. */
+static int index_only(const char *path)
+{
+  DIR dir;
+  FILINFO info;
+  FRESULT res;
+  if (f_opendir(&dir, path) != FR_OK)
+    return -1;
+  while ((res = f_readdir(&dir, &info)) == FR_OK && info.fname[0] != '\0'
+         && strcmp(info.fname, _DIRINDEX_NAME) == 0)
+    ;
+  f_closedir(&dir);
+  if (res != FR_OK)
+    return -1;
+  return info.fname[0] == '\0';
+}
+#endif
+
 int _fatfs_unlink(const char *path)
 {
 #ifdef ROM
@@ -311,16 +556,45 @@ int _fatfs_unlink(const char *path)
   return -1;
 #else
   FRESULT res;
+  _dirindex_begin(path, 1);
   res = f_unlink(path);
+  _dirindex_end();
+  /* A directory is not empty while it still holds its index, which goes
+     only once nothing else is left. */
+  if (res == FR_DENIED)
+    switch (index_only(path))
+      {
+      case 0:
+        errno = ENOTEMPTY;
+        return -1;
+      case 1:
+        if (_dirindex_drop(path) == 0)
+          res = f_unlink(path);
+        break;
+      }
   if (res != FR_OK)
     {
       errno = fresult2errno(res);
       return -1;
     }
+  _dirindex_unlinked(path);
   return 0;
 #endif
 }
 
+#ifndef ROM
+static int fatfs_fsync(struct _file *file)
+{
+  FRESULT res = f_sync(&file->fil);
+  if (res != FR_OK)
+    {
+      errno = fresult2errno(res);
+      return -1;
+    }
+  return 0;
+}
+#endif
+
 static ssize_t fatfs_write(struct _file *file, const void *buf, size_t count)
 {
 #ifdef ROM
@@ -329,7 +603,15 @@ static ssize_t fatfs_write(struct _file *file, const void *buf, size_t count)
 #else
   FRESULT res;
   unsigned bytes_written = 0;
-  res = f_write(&file->fil, buf, count, &bytes_written);
+  if (file->flags & _O_DIRECT)
+    {
+      FATFS *fs = file->fil.obj.fs;
+      _disk_begin_uncached(fs->pdrv, fs->database);
+      res = f_write(&file->fil, buf, count, &bytes_written);
+      _disk_end_uncached();
+    }
+  else
+    res = f_write(&file->fil, buf, count, &bytes_written);
   if (res != FR_OK)
     {
       errno = fresult2errno(res);
@@ -339,11 +621,179 @@ static ssize_t fatfs_write(struct _file *file, const void *buf, size_t count)
 #endif
 }
 
-static struct _file_ops fatfs_ops = {
+#ifndef ROM
+/* readv() and writev() gather short segments in a buffer allocated for the
+   call, so FatFs sees one transfer rather than one per segment, and whole
+   sectors go to the card as a single multi-block command. Segments at least
+   as long as the buffer are passed straight through, since f_read and
+   f_write already do that for them. Without memory for the buffer each
+   segment is transferred on its own. */
+#define IOV_BUF_SIZE 4096
+
+/* A gather buffer for iov, no bigger than its contents, or NULL if a single
+   segment would not need one. */
+static BYTE *alloc_iov_buf(const struct iovec *iov, int iovcnt, size_t *size)
+{
+  size_t total = 0;
+  int i;
+  if (iovcnt < 2)
+    return NULL;
+  for (i = 0; i < iovcnt && total < IOV_BUF_SIZE; i++)
+    total += iov[i].iov_len;
+  *size = total < IOV_BUF_SIZE ? total : IOV_BUF_SIZE;
+  return malloc(*size);
+}
+
+static ssize_t readv_each(struct _file *file, const struct iovec *iov, int iovcnt)
+{
+  size_t total = 0;
+  int i;
+  for (i = 0; i < iovcnt; i++)
+    {
+      ssize_t ret = fatfs_read(file, iov[i].iov_base, iov[i].iov_len);
+      if (ret < 0)
+        return total > 0 ? (ssize_t)total : -1;
+      total += ret;
+      if ((size_t)ret < iov[i].iov_len)
+        break;
+    }
+  return total;
+}
+
+static ssize_t writev_each(struct _file *file, const struct iovec *iov, int iovcnt)
+{
+  size_t total = 0;
+  int i;
+  for (i = 0; i < iovcnt; i++)
+    {
+      ssize_t ret = fatfs_write(file, iov[i].iov_base, iov[i].iov_len);
+      if (ret < 0)
+        return total > 0 ? (ssize_t)total : -1;
+      total += ret;
+      if ((size_t)ret < iov[i].iov_len)
+        break;
+    }
+  return total;
+}
+
+static ssize_t fatfs_readv(struct _file *file, const struct iovec *iov, int iovcnt)
+{
+  size_t total = 0, size;
+  BYTE *buf = alloc_iov_buf(iov, iovcnt, &size);
+  int i = 0;
+  if (buf == NULL)
+    return readv_each(file, iov, iovcnt);
+  while (i < iovcnt)
+    {
+      size_t run = 0, done;
+      ssize_t ret;
+      int j = i;
+      while (j < iovcnt && iov[j].iov_len <= size - run)
+        run += iov[j++].iov_len;
+      if (j <= i + 1)
+        {
+          /* One segment: read it in place. */
+          run = iov[i].iov_len;
+          ret = fatfs_read(file, iov[i].iov_base, run);
+          j = i + 1;
+        }
+      else
+        {
+          ret = fatfs_read(file, buf, run);
+          for (done = 0; ret > 0 && i < j && done < (size_t)ret; i++)
+            {
+              size_t n = iov[i].iov_len;
+              if (n > (size_t)ret - done)
+                n = (size_t)ret - done;
+              memcpy(iov[i].iov_base, buf + done, n);
+              done += n;
+            }
+        }
+      if (ret < 0)
+        {
+          free(buf);
+          return total > 0 ? (ssize_t)total : -1;
+        }
+      total += ret;
+      if ((size_t)ret < run)
+        break;
+      i = j;
+    }
+  free(buf);
+  return total;
+}
+
+static ssize_t fatfs_writev(struct _file *file, const struct iovec *iov, int iovcnt)
+{
+  size_t total = 0, buffered = 0, size;
+  BYTE *buf = alloc_iov_buf(iov, iovcnt, &size);
+  ssize_t ret;
+  int i;
+  if (buf == NULL)
+    return writev_each(file, iov, iovcnt);
+  for (i = 0; i < iovcnt; i++)
+    {
+      const BYTE *p = iov[i].iov_base;
+      size_t len = iov[i].iov_len;
+      while (len > 0)
+        {
+          size_t n;
+          if (buffered == 0 && len >= size)
+            {
+              ret = fatfs_write(file, p, len);
+              if (ret < 0)
+                goto fail;
+              total += ret;
+              if ((size_t)ret < len)
+                goto done;
+              break;
+            }
+          n = size - buffered;
+          if (n > len)
+            n = len;
+          memcpy(buf + buffered, p, n);
+          buffered += n;
+          p += n;
+          len -= n;
+          if (buffered == size)
+            {
+              ret = fatfs_write(file, buf, buffered);
+              if (ret < 0)
+                goto fail;
+              total += ret;
+              if ((size_t)ret < buffered)
+                goto done;
+              buffered = 0;
+            }
+        }
+    }
+  if (buffered > 0)
+    {
+      ret = fatfs_write(file, buf, buffered);
+      if (ret < 0)
+        goto fail;
+      total += ret;
+    }
+done:
+  free(buf);
+  return total;
+
+fail:
+  free(buf);
+  return total > 0 ? (ssize_t)total : -1;
+}
+#endif
+
+struct _file_ops _fatfs_ops = {
     .close = fatfs_close,
     .lseek = fatfs_lseek,
     .read = fatfs_read,
     .write = fatfs_write,
+#ifndef ROM
+    .fsync = fatfs_fsync,
+    .readv = fatfs_readv,
+    .writev = fatfs_writev,
+#endif
 };
 
 int _fatfs_open(struct _file *file, const char *filename, int flags, mode_t mode)
@@ -368,7 +818,13 @@ int _fatfs_open(struct _file *file, const char *filename, int flags, mode_t mode
     f_mode |= FA_WRITE;
   else
     f_mode |= FA_READ;
+#ifndef ROM
+  _dirindex_begin(filename, (f_mode & ~FA_READ) != 0);
+#endif
   res = f_open(&file->fil, filename, f_mode);
+#ifndef ROM
+  _dirindex_end();
+#endif
   if (res != FR_OK)
     {
       if (!_ignore_sdcard_errors)
@@ -388,6 +844,28 @@ int _fatfs_open(struct _file *file, const char *filename, int flags, mode_t mode
       errno = fresult2errno(res);
       return -1;
     }
-  file->ops = &fatfs_ops;
+  file->ops = &_fatfs_ops;
+  file->flags = flags;
+#ifndef ROM
+  /* Compressed assets are read-only. Open with O_RDWR to get at the raw
+     bytes of a .p8z file. */
+  if ((flags & O_ACCMODE) == O_RDONLY
+      && ((flags & _O_DECOMPRESS) || _p8z_name(filename)))
+    return _p8z_open(file);
+#endif
   return 0;
 }
+
+const struct _fs_ops _fatfs_fs_ops = {
+    .init = _init_fatfs,
+    .open = _fatfs_open,
+    .access = _fatfs_access,
+    .stat = _fatfs_stat,
+    .unlink = _fatfs_unlink,
+    .rename = _fatfs_rename,
+    .mkdir = _fatfs_mkdir,
+    .opendir = _fatfs_opendir,
+    .readdir = _fatfs_readdir,
+    .readdir_batch = _fatfs_readdir_batch,
+    .closedir = _fatfs_closedir,
+};
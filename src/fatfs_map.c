@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* Read-only file views.
+ *
+ * Small ranges are read eagerly into a single buffer. Larger ranges are
+ * faulted in one sector at a time by _fatfs_map_get(), which hands back a
+ * pointer straight into the sector cache in disk.c rather than copying the
+ * data into a buffer of our own. Such a pointer is only valid until the next
+ * file system call. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "disk.h"
+#include "io.h"
+#include "nextp8.h"
+
+#ifndef ROM
+#define MAP_EAGER_MAX 4096
+
+struct _fatfs_map {
+  FIL fil;              /* private read-only clone of the file object */
+  FSIZE_t offset;       /* file offset of the start of the view */
+  size_t len;           /* length of the view */
+  BYTE *data;           /* eagerly loaded contents, or NULL */
+  FSIZE_t sector_pos;   /* file offset of the mapped sector */
+  LBA_t sector;         /* sector currently mapped (0: none) */
+};
+
+struct _fatfs_map *_fatfs_map(int fd, off_t offset, size_t len)
+{
+  FRESULT res;
+  struct _file *file;
+  struct _fatfs_map *map;
+
+  file = _get_file(fd);
+  if (file == NULL)
+    return NULL;
+  if (file->ops != &_fatfs_ops)
+    {
+      errno = ENODEV;
+      return NULL;
+    }
+  if (offset < 0 || (FSIZE_t)offset > f_size(&file->fil))
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+  if (len > f_size(&file->fil) - offset)
+    len = f_size(&file->fil) - offset;
+
+  /* The view reflects what is on the card, so push out pending writes. */
+  if (file->fil.flag & FA_WRITE)
+    {
+      res = f_sync(&file->fil);
+      if (res != FR_OK)
+        {
+          errno = fresult2errno(res);
+          return NULL;
+        }
+    }
+
+  map = calloc(1, sizeof(*map));
+  if (map == NULL)
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+  map->fil.obj = file->fil.obj;
+  map->fil.flag = FA_READ;
+  map->fil.clust = map->fil.obj.sclust;
+  map->offset = offset;
+  map->len = len;
+
+  if (len <= MAP_EAGER_MAX)
+    {
+      UINT bytes_read;
+      map->data = malloc(len ? len : 1);
+      if (map->data == NULL)
+        {
+          free(map);
+          errno = ENOMEM;
+          return NULL;
+        }
+      res = f_lseek(&map->fil, offset);
+      if (res == FR_OK)
+        res = f_read(&map->fil, map->data, len, &bytes_read);
+      if (res == FR_OK && bytes_read != len)
+        res = FR_INT_ERR;
+      if (res != FR_OK)
+        {
+          free(map->data);
+          free(map);
+          errno = fresult2errno(res);
+          return NULL;
+        }
+    }
+  return map;
+}
+
+const void *_fatfs_map_get(struct _fatfs_map *map, size_t offset, size_t *avail)
+{
+  FRESULT res;
+  FSIZE_t pos, sector_pos;
+  const BYTE *data;
+
+  if (offset >= map->len)
+    {
+      errno = EINVAL;
+      return NULL;
+    }
+  if (map->data != NULL)
+    {
+      if (avail)
+        *avail = map->len - offset;
+      return map->data + offset;
+    }
+
+  pos = map->offset + offset;
+  sector_pos = pos & ~(FSIZE_t)(FF_MAX_SS - 1);
+  if (map->sector == 0 || map->sector_pos != sector_pos)
+    {
+      /* Seeking to a mid-sector position makes FatFs resolve the sector
+         number without us having to walk the cluster chain ourselves. */
+      res = f_lseek(&map->fil, sector_pos + 1);
+      if (res != FR_OK)
+        {
+          map->sector = 0;
+          errno = fresult2errno(res);
+          return NULL;
+        }
+      map->sector = map->fil.sect;
+      map->sector_pos = sector_pos;
+    }
+  data = _disk_cache_sector(map->fil.obj.fs->pdrv, map->sector);
+  if (data == NULL)
+    {
+      errno = EIO;
+      return NULL;
+    }
+  if (avail)
+    {
+      size_t n = FF_MAX_SS - (size_t)(pos - sector_pos);
+      if (n > map->len - offset)
+        n = map->len - offset;
+      *avail = n;
+    }
+  return data + (pos - sector_pos);
+}
+
+int _fatfs_unmap(struct _fatfs_map *map)
+{
+  if (map == NULL)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  free(map->data);
+  free(map);
+  return 0;
+}
+#endif
@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* Transparent decompression of .p8z files.
+ *
+ * The card is much slower than the CPU is at LZ4 decoding, so assets that
+ * are stored compressed load faster. A .p8z file (made by tools/p8z.c) is:
+ *
+ *   "P8Z1"                    magic
+ *   u32 size                  uncompressed size
+ *   u32 block_size            uncompressed bytes per block, a power of two
+ *   u32 nblocks
+ *   u32 offset[nblocks + 1]   offset of each block, then of the end
+ *   blocks                    raw LZ4 blocks
+ *
+ * All fields are little endian. Offsets are from the start of the header,
+ * so a stream can also sit inside a pack file (see pack.c). A block whose
+ * stored length equals its uncompressed length is stored as is. The offset
+ * table is the seek index: lseek() only records the new position, and the
+ * next read() decodes the one block that holds it. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include "ff.h"
+#include "io.h"
+#include "nextp8.h"
+
+#ifndef ROM
+#define P8Z_HEADER_SIZE 16
+#define P8Z_MAX_BLOCK_SIZE (64 * 1024)
+
+struct _p8z {
+  FSIZE_t base;         /* file offset of the header */
+  uint32_t size;        /* uncompressed size */
+  uint32_t block_size;
+  uint32_t nblocks;
+  uint32_t *offsets;    /* nblocks + 1 entries */
+  off_t pos;            /* uncompressed file position */
+  uint32_t block;       /* block held in data (nblocks: none) */
+  uint8_t *in;          /* compressed block */
+  uint8_t *data;        /* uncompressed block */
+};
+
+static uint32_t get_le32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16
+    | (uint32_t)p[3] << 24;
+}
+
+/* Decode one LZ4 block. Returns the number of bytes written to out, or -1
+   if the block is corrupt or does not fit in out_size bytes. */
+static int lz4_decode(const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size)
+{
+  const uint8_t *ip = in, *in_end = in + in_size;
+  uint8_t *op = out, *out_end = out + out_size;
+
+  while (ip < in_end)
+    {
+      unsigned token = *ip++;
+      size_t len = token >> 4;
+      if (len == 15)
+        {
+          unsigned b;
+          do
+            {
+              if (ip >= in_end)
+                return -1;
+              b = *ip++;
+              len += b;
+            }
+          while (b == 255);
+        }
+      if (len > (size_t)(in_end - ip) || len > (size_t)(out_end - op))
+        return -1;
+      memcpy(op, ip, len);
+      op += len;
+      ip += len;
+      if (ip == in_end)
+        break;          /* the last sequence has no match */
+
+      if (in_end - ip < 2)
+        return -1;
+      size_t offset = ip[0] | ip[1] << 8;
+      ip += 2;
+      if (offset == 0 || offset > (size_t)(op - out))
+        return -1;
+      len = (token & 15) + 4;
+      if ((token & 15) == 15)
+        {
+          unsigned b;
+          do
+            {
+              if (ip >= in_end)
+                return -1;
+              b = *ip++;
+              len += b;
+            }
+          while (b == 255);
+        }
+      if (len > (size_t)(out_end - op))
+        return -1;
+      /* Matches may overlap their own output, so copy forwards byte by
+         byte unless they are far enough apart. */
+      const uint8_t *match = op - offset;
+      if (offset >= len)
+        {
+          memcpy(op, match, len);
+          op += len;
+        }
+      else
+        while (len--)
+          *op++ = *match++;
+    }
+  return op - out;
+}
+
+/* Decode block n into dest, which has room for a whole block. */
+static int load_block(struct _file *file, uint32_t n, uint8_t *dest)
+{
+  struct _p8z *z = file->p8z;
+  uint32_t start = z->offsets[n], stored = z->offsets[n + 1] - start;
+  uint32_t len = (n == z->nblocks - 1) ? z->size - n * z->block_size : z->block_size;
+  unsigned bytes_read;
+  FRESULT res;
+
+  res = f_lseek(&file->fil, z->base + start);
+  if (res == FR_OK)
+    res = f_read(&file->fil, stored == len ? dest : z->in, stored, &bytes_read);
+  if (res != FR_OK)
+    {
+      errno = fresult2errno(res);
+      return -1;
+    }
+  if (bytes_read != stored
+      || (stored != len && lz4_decode(z->in, stored, dest, len) != (int)len))
+    {
+      errno = EIO;
+      return -1;
+    }
+  return 0;
+}
+
+static int p8z_close(struct _file *file)
+{
+  FRESULT res = f_close(&file->fil);
+  free(file->p8z->offsets);
+  free(file->p8z->in);
+  free(file->p8z->data);
+  free(file->p8z);
+  file->p8z = NULL;
+  if (res != FR_OK)
+    {
+      errno = fresult2errno(res);
+      return -1;
+    }
+  return 0;
+}
+
+static off_t p8z_lseek(struct _file *file, off_t offset, int whence)
+{
+  struct _p8z *z = file->p8z;
+  switch (whence)
+    {
+    case SEEK_SET:
+      break;
+    case SEEK_CUR:
+      offset += z->pos;
+      break;
+    case SEEK_END:
+      offset += z->size;
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+    }
+  if (offset < 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  z->pos = offset;
+  return offset;
+}
+
+static ssize_t p8z_read(struct _file *file, void *buf, size_t count)
+{
+  struct _p8z *z = file->p8z;
+  uint8_t *p = buf;
+  size_t total = 0;
+
+  while (count > 0 && z->pos < (off_t)z->size)
+    {
+      uint32_t n = z->pos / z->block_size;
+      uint32_t ofs = z->pos % z->block_size;
+      uint32_t len = (n == z->nblocks - 1) ? z->size - n * z->block_size : z->block_size;
+      size_t chunk = len - ofs;
+      if (chunk > count)
+        chunk = count;
+      if (n != z->block && ofs == 0 && chunk == len)
+        {
+          /* Whole block: decode straight into the caller's buffer. */
+          if (load_block(file, n, p) < 0)
+            return total ? (ssize_t)total : -1;
+        }
+      else
+        {
+          if (n != z->block)
+            {
+              z->block = z->nblocks;
+              if (load_block(file, n, z->data) < 0)
+                return total ? (ssize_t)total : -1;
+              z->block = n;
+            }
+          memcpy(p, z->data + ofs, chunk);
+        }
+      p += chunk;
+      count -= chunk;
+      total += chunk;
+      z->pos += chunk;
+    }
+  return total;
+}
+
+static ssize_t p8z_write(struct _file *file, const void *buf, size_t count)
+{
+  errno = EBADF;
+  return -1;
+}
+
+static struct _file_ops p8z_ops = {
+    .close = p8z_close,
+    .lseek = p8z_lseek,
+    .read = p8z_read,
+    .write = p8z_write,
+};
+
+int _p8z_name(const char *filename)
+{
+  size_t len = strlen(filename);
+  return len >= 4 && strcasecmp(filename + len - 4, ".p8z") == 0;
+}
+
+/* Switch an open FatFs file over to decompressed reads of the stream that
+   starts at the current file position. On failure the file is closed. */
+int _p8z_open(struct _file *file)
+{
+  FSIZE_t base = f_tell(&file->fil);
+  uint8_t header[P8Z_HEADER_SIZE];
+  unsigned bytes_read;
+  struct _p8z *z;
+  FRESULT res;
+  uint32_t i;
+  int err = EINVAL;
+
+  res = f_read(&file->fil, header, sizeof(header), &bytes_read);
+  if (res != FR_OK)
+    {
+      err = fresult2errno(res);
+      goto fail;
+    }
+  z = calloc(1, sizeof(*z));
+  if (z == NULL)
+    {
+      err = ENOMEM;
+      goto fail;
+    }
+  file->p8z = z;
+  z->base = base;
+  if (bytes_read != sizeof(header) || memcmp(header, "P8Z1", 4) != 0)
+    goto fail_free;
+  z->size = get_le32(header + 4);
+  z->block_size = get_le32(header + 8);
+  z->nblocks = get_le32(header + 12);
+  /* Corrupt headers must not make the offset table size wrap: work out
+     nblocks without overflow, and the table must fit in the file. */
+  if (z->block_size == 0 || z->block_size > P8Z_MAX_BLOCK_SIZE
+      || (z->block_size & (z->block_size - 1)) != 0
+      || z->nblocks != z->size / z->block_size + (z->size % z->block_size != 0)
+      || ((uint64_t)z->nblocks + 1) * sizeof(uint32_t)
+         > f_size(&file->fil) - f_tell(&file->fil))
+    goto fail_free;
+  z->block = z->nblocks;
+
+  z->offsets = malloc((z->nblocks + 1) * sizeof(uint32_t));
+  z->in = malloc(z->block_size);
+  z->data = malloc(z->block_size);
+  if (z->offsets == NULL || z->in == NULL || z->data == NULL)
+    {
+      err = ENOMEM;
+      goto fail_free;
+    }
+  res = f_read(&file->fil, z->offsets, (z->nblocks + 1) * sizeof(uint32_t), &bytes_read);
+  if (res != FR_OK)
+    {
+      err = fresult2errno(res);
+      goto fail_free;
+    }
+  if (bytes_read != (z->nblocks + 1) * sizeof(uint32_t))
+    goto fail_free;
+  for (i = 0; i <= z->nblocks; i++)
+    {
+      z->offsets[i] = get_le32((const uint8_t *)&z->offsets[i]);
+      /* A compressed block is never stored bigger than the original. */
+      if (i > 0 && (z->offsets[i] < z->offsets[i - 1]
+                    || z->offsets[i] - z->offsets[i - 1] > z->block_size))
+        goto fail_free;
+    }
+  if (z->base + z->offsets[z->nblocks] > f_size(&file->fil))
+    goto fail_free;
+
+  file->ops = &p8z_ops;
+  return 0;
+
+fail_free:
+  free(z->offsets);
+  free(z->in);
+  free(z->data);
+  free(z);
+  file->p8z = NULL;
+fail:
+  f_close(&file->fil);
+  errno = err;
+  return -1;
+}
+#endif
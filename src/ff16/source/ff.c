@@ -499,6 +499,12 @@ static const BYTE GUID_MS_Basic[16] = {0xA2,0xA0,0xD0,0xEB,0xE5,0xB9,0x33,0x44,0
 #if FF_FS_EXFAT
 #error LFN must be enabled when enable exFAT
 #endif
+#if FF_USE_FREEMAP && (FF_FS_READONLY || FF_FS_EXFAT)
+#error Free cluster map needs write support and no exFAT
+#endif
+#if FF_USE_DIRINDEX && (!FF_USE_LFN || FF_FS_READONLY)
+#error LFN and write support must be enabled when enable the directory index
+#endif
 #define DEF_NAMEBUFF
 #define INIT_NAMEBUFF(fs)
 #define FREE_NAMEBUFF()
@@ -1299,6 +1305,9 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 			break;
 		}
 	}
+#if FF_USE_FREEMAP
+	if (res == FR_OK) ff_freemap_put(fs, clst, val);	/* Keep the free cluster map in step */
+#endif
 	return res;
 }
 
@@ -1598,6 +1607,13 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 				ncl = 0;
 			}
 		}
+#if FF_USE_FREEMAP
+		if (ncl == 0) {	/* The new cluster cannot be contiguous, look up the free cluster map */
+			ncl = ff_freemap_find(fs, scl);
+			if (ncl == 0) return 0;			/* No free cluster? */
+			if (ncl == 0xFFFFFFFF) ncl = 0;	/* No map, scan the FAT */
+		}
+#endif
 		if (ncl == 0) {	/* The new cluster cannot be contiguous and find another fragment */
 			ncl = scl;	/* Start cluster */
 			for (;;) {
@@ -2409,8 +2425,9 @@ static FRESULT dir_read (
 /* Directory handling - Find an object in the directory                  */
 /*-----------------------------------------------------------------------*/
 
-static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
-	DIR* dp					/* Pointer to the directory object with the file name */
+static FRESULT dir_scan (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp,				/* Pointer to the directory object with the file name */
+	UINT n_ent				/* Number of entries to examine from the current one (0:all) */
 )
 {
 	FRESULT res;
@@ -2420,29 +2437,6 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 	BYTE attr, ord, sum;
 #endif
 
-	res = dir_sdi(dp, 0);			/* Rewind directory object */
-	if (res != FR_OK) return res;
-#if FF_FS_EXFAT
-	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
-		BYTE nc;
-		UINT di, ni;
-		WORD hash = xname_sum(fs->lfnbuf);		/* Hash value of the name to find */
-
-		while ((res = DIR_READ_FILE(dp)) == FR_OK) {	/* Read an item */
-#if FF_MAX_LFN < 255
-			if (fs->dirbuf[XDIR_NumName] > FF_MAX_LFN) continue;		/* Skip comparison if inaccessible object name */
-#endif
-			if (ld_16(fs->dirbuf + XDIR_NameHash) != hash) continue;	/* Skip comparison if hash mismatched */
-			for (nc = fs->dirbuf[XDIR_NumName], di = SZDIRE * 2, ni = 0; nc; nc--, di += 2, ni++) {	/* Compare the name */
-				if ((di % SZDIRE) == 0) di += 2;
-				if (ff_wtoupper(ld_16(fs->dirbuf + di)) != ff_wtoupper(fs->lfnbuf[ni])) break;
-			}
-			if (nc == 0 && !fs->lfnbuf[ni]) break;	/* Name matched? */
-		}
-		return res;
-	}
-#endif
-	/* On the FAT/FAT32 volume */
 #if FF_USE_LFN
 	ord = sum = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
 #endif
@@ -2478,6 +2472,7 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 		if (!(dp->dir[DIR_Attr] & AM_VOL) && !memcmp(dp->dir, dp->fn, 11)) break;	/* Is it a valid entry? */
 #endif
 		res = dir_next(dp, 0);	/* Next entry */
+		if (res == FR_OK && n_ent && --n_ent == 0) res = FR_NO_FILE;	/* Examined as many entries as asked */
 	} while (res == FR_OK);
 
 	return res;
@@ -2485,6 +2480,65 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 
 
 
+static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp					/* Pointer to the directory object with the file name */
+)
+{
+	FRESULT res;
+#if FF_FS_EXFAT || FF_USE_DIRINDEX
+	FATFS *fs = dp->obj.fs;
+#endif
+#if FF_USE_DIRINDEX
+	DWORD ofs;
+#endif
+
+	res = dir_sdi(dp, 0);			/* Rewind directory object */
+	if (res != FR_OK) return res;
+#if FF_FS_EXFAT
+	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
+		BYTE nc;
+		UINT di, ni;
+		WORD hash = xname_sum(fs->lfnbuf);		/* Hash value of the name to find */
+
+		while ((res = DIR_READ_FILE(dp)) == FR_OK) {	/* Read an item */
+#if FF_MAX_LFN < 255
+			if (fs->dirbuf[XDIR_NumName] > FF_MAX_LFN) continue;		/* Skip comparison if inaccessible object name */
+#endif
+			if (ld_16(fs->dirbuf + XDIR_NameHash) != hash) continue;	/* Skip comparison if hash mismatched */
+			for (nc = fs->dirbuf[XDIR_NumName], di = SZDIRE * 2, ni = 0; nc; nc--, di += 2, ni++) {	/* Compare the name */
+				if ((di % SZDIRE) == 0) di += 2;
+				if (ff_wtoupper(ld_16(fs->dirbuf + di)) != ff_wtoupper(fs->lfnbuf[ni])) break;
+			}
+			if (nc == 0 && !fs->lfnbuf[ni]) break;	/* Name matched? */
+		}
+		return res;
+	}
+#endif
+	/* On the FAT/FAT32 volume */
+#if FF_USE_DIRINDEX
+	if (!(dp->fn[NSFLAG] & NS_NOLFN)) {	/* Not a numbered SFN collision check? */
+		ofs = ff_dirindex_lookup(fs, dp->obj.sclust, fs->lfnbuf);	/* Ask the index where the entry block is */
+		if (ofs != 0xFFFFFFFF) {
+			if (dir_sdi(dp, ofs) == FR_OK) {
+				res = dir_scan(dp, (FF_MAX_LFN + 12) / 13 + 1);	/* Examine that entry block only */
+				if (res != FR_NO_FILE) return res;
+			}
+			ff_dirindex_stale(fs, dp->obj.sclust, ofs);	/* Wrong hint, fall back to the full scan */
+			res = dir_sdi(dp, 0);
+			if (res != FR_OK) return res;
+		}
+		res = dir_scan(dp, 0);
+		if (res == FR_OK) {	/* Let the index learn where the entry block is */
+			ff_dirindex_found(fs, dp->obj.sclust, fs->lfnbuf, dp->blk_ofs != 0xFFFFFFFF ? dp->blk_ofs : dp->dptr, dp->dptr / SZDIRE + 1);
+		}
+		return res;
+	}
+#endif
+	return dir_scan(dp, 0);
+}
+
+
+
 
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
@@ -2559,6 +2613,9 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 	/* Create an SFN with/without LFNs. */
 	n_ent = (sn[NSFLAG] & NS_LFN) ? (len + 12) / 13 + 1 : 1;	/* Number of entries to allocate */
 	res = dir_alloc(dp, n_ent);		/* Allocate entries */
+#if FF_USE_DIRINDEX
+	if (res == FR_OK) dp->blk_ofs = dp->dptr - SZDIRE * (n_ent - 1);	/* Set the allocated entry block offset */
+#endif
 	if (res == FR_OK && --n_ent) {	/* Set LFN entry if needed */
 		res = dir_sdi(dp, dp->dptr - n_ent * SZDIRE);
 		if (res == FR_OK) {
@@ -2589,6 +2646,9 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 			dp->dir[DIR_NTres] = dp->fn[NSFLAG] & (NS_BODY | NS_EXT);	/* Put low-case flags */
 #endif
 			fs->wflag = 1;
+#if FF_USE_DIRINDEX
+			ff_dirindex_found(fs, dp->obj.sclust, fs->lfnbuf, dp->blk_ofs, 0);	/* Let the index learn the new entry block */
+#endif
 		}
 	}
 
@@ -4844,6 +4904,44 @@ FRESULT f_readdir (
 
 
 
+#if FF_USE_DIRINDEX
+/*-----------------------------------------------------------------------*/
+/* Read Directory Entries with the Entry Block Offset (for the index)    */
+/*-----------------------------------------------------------------------*/
+
+FRESULT ff_dirindex_read (
+	DIR* dp,			/* Pointer to the open directory object */
+	FILINFO* fno,		/* Pointer to file information to return */
+	DWORD* ofs			/* Pointer to return the offset of the item's entry block */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DEF_NAMEBUFF
+
+
+	res = validate(&dp->obj, &fs);	/* Check validity of the directory object */
+	if (res == FR_OK) {
+		INIT_NAMEBUFF(fs);
+		fno->fname[0] = 0;				/* Clear file information */
+		res = DIR_READ_FILE(dp);		/* Read an item */
+		if (res == FR_NO_FILE) res = FR_OK;	/* Ignore end of directory */
+		if (res == FR_OK) {				/* A valid entry is found */
+			get_fileinfo(dp, fno);		/* Get the object information */
+			*ofs = (dp->blk_ofs != 0xFFFFFFFF) ? dp->blk_ofs : dp->dptr;
+			res = dir_next(dp, 0);		/* Increment index for next */
+			if (res == FR_NO_FILE) res = FR_OK;	/* Ignore end of directory now */
+		}
+		FREE_NAMEBUFF();
+	}
+
+	if (res != FR_OK) fno->fname[0] = 0;	/* Clear the file information if any error occured */
+	LEAVE_FF(fs, res);
+}
+#endif
+
+
+
 #if FF_USE_FIND
 /*-----------------------------------------------------------------------*/
 /* API: Find Next File                                                   */
@@ -4957,6 +5055,15 @@ FRESULT f_getfree (
 
 	if (res == FR_OK) {
 		*fatfs = fs;				/* Return ptr to the fs object */
+#if FF_USE_FREEMAP
+		if (fs->free_clst > fs->n_fatent - 2) {	/* Take the count from the free cluster map if there is one */
+			nfree = ff_freemap_count(fs);
+			if (nfree != 0xFFFFFFFF) {
+				fs->free_clst = nfree;
+				fs->fsi_flag |= 1;
+			}
+		}
+#endif
 		/* If free_clst is valid, return it without full FAT scan */
 		if (fs->free_clst <= fs->n_fatent - 2) {
 			*nclst = fs->free_clst;
@@ -5763,23 +5870,30 @@ FRESULT f_expand (
 	} else
 #endif
 	{
-		scl = clst = stcl; ncl = 0;
-		for (;;) {	/* Find a contiguous cluster block */
-			n = get_fat(&fp->obj, clst);
-			if (++clst >= fs->n_fatent) clst = 2;
-			if (n == 1) {
-				res = FR_INT_ERR; break;
-			}
-			if (n == 0xFFFFFFFF) {
-				res = FR_DISK_ERR; break;
-			}
-			if (n == 0) {	/* Is it a free cluster? */
-				if (++ncl == tcl) break;	/* Break if a contiguous cluster block is found */
-			} else {
-				scl = clst; ncl = 0;		/* Not a free cluster */
-			}
-			if (clst == stcl) {		/* No contiguous cluster? */
-				res = FR_DENIED; break;
+		scl = 0xFFFFFFFF;
+#if FF_USE_FREEMAP
+		scl = ff_freemap_find_run(fs, stcl, tcl);	/* Find a contiguous cluster block in the free cluster map */
+		if (scl == 0) res = FR_DENIED;				/* No contiguous cluster block was found */
+#endif
+		if (scl == 0xFFFFFFFF) {	/* No map, scan the FAT */
+			scl = clst = stcl; ncl = 0;
+			for (;;) {	/* Find a contiguous cluster block */
+				n = get_fat(&fp->obj, clst);
+				if (++clst >= fs->n_fatent) clst = 2;
+				if (n == 1) {
+					res = FR_INT_ERR; break;
+				}
+				if (n == 0xFFFFFFFF) {
+					res = FR_DISK_ERR; break;
+				}
+				if (n == 0) {	/* Is it a free cluster? */
+					if (++ncl == tcl) break;	/* Break if a contiguous cluster block is found */
+				} else {
+					scl = clst; ncl = 0;		/* Not a free cluster */
+				}
+				if (clst == stcl) {		/* No contiguous cluster? */
+					res = FR_DENIED; break;
+				}
 			}
 		}
 		if (res == FR_OK) {	/* A contiguous free area is found */
@@ -389,6 +389,28 @@ DWORD ff_wtoupper (DWORD uni);			/* Unicode upper-case conversion */
 #endif
 
 
+/* Directory index hooks (provided by user) */
+
+#if FF_USE_DIRINDEX
+DWORD ff_dirindex_lookup (FATFS* fs, DWORD sclust, const WCHAR* name);	/* Get the likely entry block offset of the name (0xFFFFFFFF:unknown) */
+void ff_dirindex_stale (FATFS* fs, DWORD sclust, DWORD ofs);	/* The offset given by ff_dirindex_lookup() was wrong */
+void ff_dirindex_found (FATFS* fs, DWORD sclust, const WCHAR* name, DWORD ofs, DWORD n_ent);	/* The name was found/created at the offset after examining n_ent entries */
+FRESULT ff_dirindex_read (DIR* dp, FILINFO* fno, DWORD* ofs);	/* f_readdir() that also returns the entry block offset */
+#endif
+
+
+/* Free cluster map hooks (provided by user) */
+
+#if FF_USE_FREEMAP
+DWORD ff_freemap_find (FATFS* fs, DWORD scl);	/* Get the first free cluster after scl (0:none, 0xFFFFFFFF:no map) */
+DWORD ff_freemap_count (FATFS* fs);	/* Get the number of free clusters (0xFFFFFFFF:no map) */
+void ff_freemap_put (FATFS* fs, DWORD clst, DWORD val);	/* A FAT entry has been changed */
+#if FF_USE_EXPAND
+DWORD ff_freemap_find_run (FATFS* fs, DWORD scl, DWORD ncl);	/* Find ncl contiguous free clusters, erase block aligned if possible (0:none, 0xFFFFFFFF:no map) */
+#endif
+#endif
+
+
 /* O/S dependent functions (samples available in ffsystem.c) */
 
 #if FF_USE_LFN == 3		/* Dynamic memory allocation */
@@ -46,11 +46,19 @@
 /* This option switches fast seek feature. (0:Disable or 1:Enable) */
 
 
+#ifdef ROM
 #define FF_USE_EXPAND	0
+#else
+#define FF_USE_EXPAND	1
+#endif
 /* This option switches f_expand(). (0:Disable or 1:Enable) */
 
 
+#ifdef ROM
 #define FF_USE_CHMOD	0
+#else
+#define FF_USE_CHMOD	1
+#endif
 /* This option switches attribute control API functions, f_chmod() and f_utime().
 /  (0:Disable or 1:Enable) Also FF_FS_READONLY needs to be 0 to enable this option. */
 
@@ -87,6 +95,31 @@
 /   3: Unicode in UTF-8
 */
 
+#ifdef ROM
+#define FF_USE_DIRINDEX	0
+#else
+#define FF_USE_DIRINDEX	1
+#endif
+/* This option switches the directory index hooks. (0:Disable or 1:Enable)
+/  When enabled, dir_find() asks ff_dirindex_lookup() for the likely offset of
+/  the entry block before falling back to a linear scan, and reports what it
+/  finds or creates to ff_dirindex_found(). The hooks are provided by the user
+/  (nextp8: dirindex.c). Requires FF_USE_LFN >= 1 and FF_FS_READONLY == 0. */
+
+
+#ifdef ROM
+#define FF_USE_FREEMAP	0
+#else
+#define FF_USE_FREEMAP	1
+#endif
+/* This option switches the free cluster map hooks. (0:Disable or 1:Enable)
+/  When enabled, create_chain() and f_getfree() ask ff_freemap_find() and
+/  ff_freemap_count() before scanning the FAT, and put_fat() reports every
+/  change to ff_freemap_put(). With FF_USE_EXPAND, f_expand() also asks
+/  ff_freemap_find_run(). The hooks are provided by the user (nextp8:
+/  freemap.c). Not available for exFAT or read-only configurations. */
+
+
 
 /*---------------------------------------------------------------------------/
 / Locale and Namespace Configurations
@@ -237,7 +270,11 @@
 /  f_fdisk(). 2^32 sectors maximum. This option has no effect when FF_LBA64 == 0. */
 
 
+#ifdef ROM
 #define FF_USE_TRIM		0
+#else
+#define FF_USE_TRIM		1
+#endif
 /* This option switches support for ATA-TRIM. (0:Disable or 1:Enable)
 /  To enable this feature, also CTRL_TRIM command should be implemented to
 /  the disk_ioctl(). */
@@ -248,7 +285,11 @@
 / System Configurations
 /---------------------------------------------------------------------------*/
 
+#ifdef ROM
 #define FF_FS_TINY		0
+#else
+#define FF_FS_TINY		1
+#endif
 /* This option switches tiny buffer configuration. (0:Normal or 1:Tiny)
 /  At the tiny configuration, size of file object (FIL) is reduced FF_MAX_SS bytes.
 /  Instead of private sector buffer eliminated from the file object, common sector
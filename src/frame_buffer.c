@@ -19,84 +19,337 @@
 #include "mmio.h"
 #include "font.h"
 
-static int cursor_x = 0, cursor_y = 0;
-static int bg_index = _DARK_BLUE;
+/* Block fill and copy for frame buffers, overlays and palettes.
+ *
+ * The middle of a block moves in 32-byte bursts: one movem.l of eight
+ * registers per burst to fill, and a movem.l load and store to copy. What
+ * is left over goes a long word at a time, four to a loop, and any odd
+ * bytes at the ends one at a time. The frame buffers, overlays and palettes
+ * are 16-byte aligned and a multiple of 16 bytes long, so their routines
+ * call the aligned parts directly. */
+#define BURST 32
 
-void _clear_screen(int colour_index)
+static void fill_bursts(uint32_t *dst, uint32_t v, size_t bursts)
 {
-    memset((char *)_BACK_BUFFER_BASE, (colour_index & 15) | ((colour_index & 15) << 4), _FRAME_BUFFER_SIZE);
-    cursor_x = 0;
-    cursor_y = 0;
-    bg_index = colour_index;
+#ifdef __m68k__
+  register uint32_t *end __asm__ ("a0") = dst + bursts * (BURST / 4);
+  register uint32_t value __asm__ ("d0") = v;
+  register size_t n __asm__ ("d1") = bursts;
+  if (n == 0)
+    return;
+  __asm__ __volatile__ ("move.l %2,%%d2\n\t"
+                        "move.l %2,%%d3\n\t"
+                        "move.l %2,%%d4\n\t"
+                        "move.l %2,%%d5\n\t"
+                        "move.l %2,%%d6\n\t"
+                        "move.l %2,%%d7\n\t"
+                        "move.l %2,%%a1\n"
+                        "1:\n\t"
+                        "movem.l %%d0/%%d2-%%d7/%%a1,-(%0)\n\t"
+                        "subq.l #1,%1\n\t"
+                        "bne.s 1b"
+                        : "+a" (end), "+d" (n)
+                        : "d" (value)
+                        : "d2", "d3", "d4", "d5", "d6", "d7", "a1", "memory");
+#else
+  size_t n = bursts * (BURST / 4);
+  while (n-- > 0)
+    *dst++ = v;
+#endif
 }
 
-static void display_char(int left_margin, int *x, int *y, char c)
+/* Copies forwards, so dst may overlap src if it is below it. */
+static void copy_bursts(uint32_t *dst, const uint32_t *src, size_t bursts)
 {
-  if (*y < _SCREEN_HEIGHT)
+#ifdef __m68k__
+  register const uint32_t *s __asm__ ("a0") = src;
+  register uint32_t *d __asm__ ("a1") = dst;
+  register size_t n __asm__ ("d0") = bursts;
+  if (n == 0)
+    return;
+  __asm__ __volatile__ ("1:\n\t"
+                        "movem.l (%0)+,%%d1-%%d7/%%a2\n\t"
+                        "movem.l %%d1-%%d7/%%a2,(%1)\n\t"
+                        "lea 32(%1),%1\n\t"
+                        "subq.l #1,%2\n\t"
+                        "bne.s 1b"
+                        : "+a" (s), "+a" (d), "+d" (n)
+                        :
+                        : "d1", "d2", "d3", "d4", "d5", "d6", "d7", "a2",
+                          "memory");
+#else
+  size_t n = bursts * (BURST / 4);
+  while (n-- > 0)
+    *dst++ = *src++;
+#endif
+}
+
+/* dst and len are multiples of 4. */
+static void fill_aligned(uint32_t *dst, uint32_t v, size_t len)
+{
+  size_t bursts = len / BURST, n = (len % BURST) / 4;
+  fill_bursts(dst, v, bursts);
+  dst += bursts * (BURST / 4);
+  for (; n >= 4; n -= 4, dst += 4)
     {
-      if (c >= 32 && c < 127)
-        {
-          for (int yy=0;yy<5;++yy)
-            {
-              for (int xx=0;xx<2;++xx)
-                {
-                  if (*y + yy >= 0 && *y + yy < _SCREEN_HEIGHT &&
-                      *x + xx >= 0 && *x + xx + 1 < _SCREEN_WIDTH)
-                    {
-                      *(uint8_t *)(_BACK_BUFFER_BASE + (*y + yy) * 64 + *x / 2 + xx) |= __font[c-32][yy][xx];
-                    }
-                }
-              }
-        }
-      *x += _FONT_CHAR_WIDTH;
-      if (*x >= _SCREEN_WIDTH || c == '\n')
-        {
-          *x = left_margin;
-          *y += _FONT_LINE_HEIGHT;
-        }
+      dst[0] = v;
+      dst[1] = v;
+      dst[2] = v;
+      dst[3] = v;
     }
+  while (n-- > 0)
+    *dst++ = v;
 }
 
-void _display_string(int x, int y, const char *message)
+/* dst, src and len are multiples of 4. */
+static void copy_aligned(uint32_t *dst, const uint32_t *src, size_t len)
 {
-  int left_margin = x;
-  while (*message)
+  size_t bursts = len / BURST, n = (len % BURST) / 4;
+  copy_bursts(dst, src, bursts);
+  dst += bursts * (BURST / 4);
+  src += bursts * (BURST / 4);
+  for (; n >= 4; n -= 4, dst += 4, src += 4)
     {
-      display_char(left_margin, &x, &y, *message++);
+      dst[0] = src[0];
+      dst[1] = src[1];
+      dst[2] = src[2];
+      dst[3] = src[3];
     }
+  while (n-- > 0)
+    *dst++ = *src++;
 }
 
-#if 0
-static void scroll(int amount)
+/* Set len bytes at dst to colour_index in both pixels. */
+void _fb_fill(void *dst, int colour_index, size_t len)
 {
-  memmove((char *)_BACK_BUFFER_BASE, (char *)_BACK_BUFFER_BASE + amount*64, _FRAME_BUFFER_SIZE - amount*64);
-  memset((char *)_BACK_BUFFER_BASE + (_SCREEN_HEIGHT-amount)*64, (bg_index & 15) | ((bg_index & 15) << 4), amount*64);
+  uint8_t *d = dst;
+  uint8_t b = (colour_index & 15) * 0x11;
+  size_t middle;
+  while (len > 0 && ((uintptr_t)d & 3) != 0)
+    {
+      *d++ = b;
+      len--;
+    }
+  middle = len & ~(size_t)3;
+  fill_aligned((uint32_t *)d, b * 0x01010101u, middle);
+  d += middle;
+  len -= middle;
+  while (len-- > 0)
+    *d++ = b;
 }
 
-void _print_char(char c)
+/* Copy len bytes from src to dst. The copy runs forwards, so the blocks
+   may overlap if dst is below src, as when scrolling up. */
+void _fb_copy(void *dst, const void *src, size_t len)
 {
-  if (cursor_y + _FONT_CHAR_HEIGHT > _SCREEN_HEIGHT)
+  uint8_t *d = dst;
+  const uint8_t *s = src;
+  size_t middle;
+  if ((((uintptr_t)d ^ (uintptr_t)s) & 3) != 0)
     {
-      scroll(cursor_y + _FONT_CHAR_HEIGHT - _SCREEN_HEIGHT);
-      cursor_y = _SCREEN_HEIGHT - FONT_CHAR_HEIGHT;
+      /* Never long aligned together. */
+      while (len-- > 0)
+        *d++ = *s++;
+      return;
     }
-  if (c == '\n')
+  while (len > 0 && ((uintptr_t)d & 3) != 0)
     {
-      cursor_x = 0;
-      cursor_y += _FONT_LINE_HEIGHT;
-    } 
+      *d++ = *s++;
+      len--;
+    }
+  middle = len & ~(size_t)3;
+  copy_aligned((uint32_t *)d, (const uint32_t *)s, middle);
+  d += middle;
+  s += middle;
+  len -= middle;
+  while (len-- > 0)
+    *d++ = *s++;
+}
+
+void _clear_screen(int colour_index)
+{
+    fill_aligned((uint32_t *)_BACK_BUFFER_BASE,
+                 (colour_index & 15) * 0x11111111u, _FRAME_BUFFER_SIZE);
+}
+
+void _clear_overlay(int colour_index)
+{
+  fill_aligned((uint32_t *)_OVERLAY_BACK_BUFFER_BASE,
+               (colour_index & 15) * 0x11111111u, _FRAME_BUFFER_SIZE);
+}
+
+/* Load the 16 entries of the palette at base, _PALETTE_BASE or
+   _SECONDARY_PALETTE_BASE. */
+void _load_palette(uintptr_t base, const uint8_t *colours)
+{
+  if (((uintptr_t)colours & 3) == 0)
+    copy_aligned((uint32_t *)base, (const uint32_t *)colours, _PALETTE_SIZE);
   else
+    _fb_copy((void *)base, colours, _PALETTE_SIZE);
+}
+
+#define LINE_BYTES (_SCREEN_WIDTH / 2)
+#define FULL_MASK 0xFFFFFFu
+
+/* A glyph row covers two bytes at an even x and three at an odd x. The
+   masks hold those bytes as a 24-bit big-endian value, the first byte in
+   bits 23-16, with 0xf in each nibble the glyph sets. As the left pixel of
+   a byte is its low nibble, shifting a glyph by one pixel is not a shift
+   of the mask, so both alignments are tabulated from __font on first use. */
+static uint32_t glyph_mask[2][96][_FONT_CHAR_HEIGHT];
+static uint32_t cell_mask[2];
+static int glyph_masks_ready;
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define FB16(v) ((uint16_t)(v))
+#else
+#define FB16(v) __builtin_bswap16((uint16_t)(v))
+#endif
+
+/* The mask for the pixels in bitmap (bit i: pixel i), shift pixels in. */
+static uint32_t nibble_mask(unsigned bitmap, int shift)
+{
+  uint32_t m = 0;
+  int i;
+  for (i = 0; i < _FONT_CHAR_WIDTH; i++)
+    if (bitmap & (1 << i))
+      {
+        int pos = i + shift;
+        m |= (uint32_t)0xf << ((2 - pos / 2) * 8 + (pos & 1) * 4);
+      }
+  return m;
+}
+
+static void make_glyph_masks(void)
+{
+  int shift, g, y, i;
+  for (shift = 0; shift < 2; shift++)
     {
-      display_char(0, &cursor_x, &cursor_y, c);
+      cell_mask[shift] = nibble_mask((1 << _FONT_CHAR_WIDTH) - 1, shift);
+      for (g = 0; g < 96; g++)
+        for (y = 0; y < _FONT_CHAR_HEIGHT; y++)
+          {
+            unsigned bitmap = 0;
+            for (i = 0; i < _FONT_CHAR_WIDTH; i++)
+              if ((__font[g][y][i / 2] >> ((i & 1) * 4)) & 0xf)
+                bitmap |= 1 << i;
+            glyph_mask[shift][g][y] = nibble_mask(bitmap, shift);
+          }
     }
+  glyph_masks_ready = 1;
 }
 
-void _print_string(const char *message)
+static inline void put8(uint8_t *p, uint32_t keep, uint32_t bits)
 {
+  *p = (*p & keep) | (uint8_t)bits;
+}
+
+static inline void put16(uint8_t *p, uint32_t keep, uint32_t bits)
+{
+  *(uint16_t *)p = (*(uint16_t *)p & FB16(keep)) | FB16(bits);
+}
+
+/* Draw character c with its top left pixel at (x, y) in buffer, a frame
+   buffer or overlay buffer, in colour fg on bg, or on what is already
+   there if bg is _TRANSPARENT. The glyph is clipped to the screen. */
+void _draw_char(void *buffer, int x, int y, int c, int fg, int bg)
+{
+  int shift = x & 1, y0 = 0, y1 = _FONT_CHAR_HEIGHT, yy;
+  uint32_t clip = FULL_MASK, fg_pattern, bg_pattern, cell;
+  const uint32_t *mask;
+  uint8_t *line;
+
+  if (x <= -_FONT_CHAR_WIDTH || x >= _SCREEN_WIDTH
+      || y <= -_FONT_CHAR_HEIGHT || y >= _SCREEN_HEIGHT)
+    return;
+  if (!glyph_masks_ready)
+    make_glyph_masks();
+  if (c < 32 || c >= 127)
+    c = ' ';
+  if (y < 0)
+    y0 = -y;
+  if (y + _FONT_CHAR_HEIGHT > _SCREEN_HEIGHT)
+    y1 = _SCREEN_HEIGHT - y;
+  if (x < 0 || x + _FONT_CHAR_WIDTH > _SCREEN_WIDTH)
+    {
+      unsigned visible = 0;
+      int i;
+      for (i = 0; i < _FONT_CHAR_WIDTH; i++)
+        if (x + i >= 0 && x + i < _SCREEN_WIDTH)
+          visible |= 1 << i;
+      clip = nibble_mask(visible, shift);
+    }
+
+  mask = glyph_mask[shift][c - 32];
+  cell = cell_mask[shift] & clip;
+  fg_pattern = (fg & 15) * 0x111111u;
+  bg_pattern = (bg & 15) * 0x111111u;
+  line = (uint8_t *)buffer + (y + y0) * LINE_BYTES;
+  for (yy = y0; yy < y1; yy++, line += LINE_BYTES)
+    {
+      uint32_t g = mask[yy] & clip, bits, keep;
+      if (bg == _TRANSPARENT)
+        {
+          bits = g & fg_pattern;
+          keep = ~g;
+        }
+      else
+        {
+          bits = (g & fg_pattern) | (cell & ~g & bg_pattern);
+          keep = ~cell;
+        }
+      if (clip != FULL_MASK)
+        {
+          /* At the edge of the screen: only touch the bytes on it. */
+          int col = x >> 1, k;
+          for (k = 0; k < 3; k++)
+            if (col + k >= 0 && col + k < LINE_BYTES)
+              put8(line + col + k, keep >> (16 - 8 * k), bits >> (16 - 8 * k));
+        }
+      else
+        {
+          uint8_t *p = line + (x >> 1);
+          if (((uintptr_t)p & 1) == 0)
+            {
+              put16(p, keep >> 8, bits >> 8);
+              if (shift)
+                put8(p + 2, keep, bits);
+            }
+          else
+            {
+              put8(p, keep >> 16, bits >> 16);
+              if (shift)
+                put16(p + 1, keep, bits);
+              else
+                put8(p + 1, keep >> 8, bits >> 8);
+            }
+        }
+    }
+}
+
+static void display_char(int left_margin, int *x, int *y, char c)
+{
+  if (*y < _SCREEN_HEIGHT)
+    {
+      if (c >= 32 && c < 127)
+        _draw_char((void *)_BACK_BUFFER_BASE, *x, *y, c, 15, _TRANSPARENT);
+      *x += _FONT_CHAR_WIDTH;
+      if (*x >= _SCREEN_WIDTH || c == '\n')
+        {
+          *x = left_margin;
+          *y += _FONT_LINE_HEIGHT;
+        }
+    }
+}
+
+void _display_string(int x, int y, const char *message)
+{
+  int left_margin = x;
   while (*message)
-    _print_char(*message++);
+    {
+      display_char(left_margin, &x, &y, *message++);
+    }
 }
-#endif
 
 void _display_string_centered(int centre_x, int centre_y, const char *message)
 {
@@ -126,6 +379,10 @@ void _display_string_centered(int centre_x, int centre_y, const char *message)
 
 void _flip(void)
 {
+#ifndef ROM
+  _flip_async();
+  _flip_wait();
+#else
   int vfront = MMIO_REG8(_VFRONT);
   int vback = 1 - vfront;
   int vfrontreq = vback;
@@ -133,9 +390,17 @@ void _flip(void)
   while (MMIO_REG8(_VFRONT) != vfrontreq) {
     // wait for flip to complete
   }
+#endif
 }
 
 void _copy_front_to_back(void)
 {
-  memcpy((uint8_t *)_BACK_BUFFER_BASE, (uint8_t *)_FRONT_BUFFER_BASE, _FRAME_BUFFER_SIZE);
+  copy_aligned((uint32_t *)_BACK_BUFFER_BASE,
+               (const uint32_t *)_FRONT_BUFFER_BASE, _FRAME_BUFFER_SIZE);
+}
+
+void _copy_overlay_front_to_back(void)
+{
+  copy_aligned((uint32_t *)_OVERLAY_BACK_BUFFER_BASE,
+               (const uint32_t *)_OVERLAY_FRONT_BUFFER_BASE, _FRAME_BUFFER_SIZE);
 }
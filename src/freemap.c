@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* Free cluster map.
+ *
+ * create_chain() in ff.c finds a free cluster by reading FAT entries one at
+ * a time from the last allocation onwards, and f_getfree() reads the whole
+ * FAT when FSINFO cannot be trusted. On a full or fragmented card that means
+ * many FAT sector reads for each cluster of a save. Instead we keep one bit
+ * per cluster (set: free) and answer both from RAM.
+ *
+ * The map is built by reading the FAT FREEMAP_CHUNK sectors at a time, a
+ * little at a time through _fatfs_freemap_build(), which _fatfs_idle()
+ * calls. Building it on demand would read the whole FAT, several megabytes
+ * on a large FAT32 card, in the middle of the first write after mounting,
+ * so until it is complete FatFs scans the FAT as usual. put_fat() reports
+ * every FAT change, so the map stays right while the FAT sector window is
+ * still dirty. FAT sectors are read around the window, so a dirty window is
+ * used in place of the stale copy on the card.
+ *
+ * f_expand() asks for contiguous runs here too. Runs that start on an
+ * erase block boundary (the card's allocation unit, from GET_BLOCK_SIZE)
+ * are preferred, so a preallocated file does not share its first and last
+ * AU with other data.
+ *
+ * FAT12 volumes and volumes with more than FREEMAP_MAX_CLUSTERS clusters
+ * are left to FatFs' own scan. That limit covers a 32 GB card with the
+ * usual 32 KB clusters and keeps the map to at most 128 KB of heap.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "diskio.h"
+#include "io.h"
+
+#ifndef ROM
+#define FREEMAP_CHUNK 8
+#define FREEMAP_MAX_CLUSTERS (1024u * 1024)
+
+struct freemap
+{
+  FATFS *fs;
+  WORD id;              /* mount ID the map was built for */
+  uint32_t *bits;       /* one bit per cluster, set if free */
+  DWORD nfree;          /* free clusters in the part built so far */
+  DWORD next;           /* next FAT sector to read */
+  bool done;
+  bool failed;          /* unsupported volume or read error */
+};
+
+static struct freemap freemaps[FF_VOLUMES];
+static BYTE chunk[FREEMAP_CHUNK * FF_MAX_SS];
+
+static struct freemap *get_freemap(FATFS *fs)
+{
+  struct freemap *map, *unused = NULL;
+  for (map = freemaps; map < freemaps + FF_VOLUMES; map++)
+    {
+      if (map->fs == fs)
+        break;
+      if (map->fs == NULL && unused == NULL)
+        unused = map;
+    }
+  if (map == freemaps + FF_VOLUMES)
+    {
+      if (unused == NULL)
+        return NULL;
+      map = unused;
+      map->fs = fs;
+      map->id = fs->id - 1;
+    }
+  if (map->id != fs->id)
+    {
+      /* Remounted: start again. */
+      free(map->bits);
+      memset(map, 0, sizeof(*map));
+      map->fs = fs;
+      map->id = fs->id;
+      if ((fs->fs_type != FS_FAT16 && fs->fs_type != FS_FAT32)
+          || fs->n_fatent > FREEMAP_MAX_CLUSTERS)
+        map->failed = true;
+      else
+        {
+          map->bits = calloc((fs->n_fatent + 31) / 32, sizeof(uint32_t));
+          if (map->bits == NULL)
+            map->failed = true;
+        }
+    }
+  return map;
+}
+
+static int build_step(struct freemap *map, UINT max_sectors)
+{
+  FATFS *fs = map->fs;
+  UINT per_sector = (fs->fs_type == FS_FAT16) ? FF_MAX_SS / 2 : FF_MAX_SS / 4;
+  DWORD nsectors = (fs->n_fatent + per_sector - 1) / per_sector;
+  DWORD clst, end;
+  UINT n, i;
+  const BYTE *p;
+
+  while (!map->done && !map->failed && max_sectors > 0)
+    {
+      n = FREEMAP_CHUNK;
+      if (n > max_sectors)
+        n = max_sectors;
+      if (n > nsectors - map->next)
+        n = nsectors - map->next;
+      if (disk_read(fs->pdrv, chunk, fs->fatbase + map->next, n) != RES_OK)
+        {
+          map->failed = true;
+          break;
+        }
+      if (fs->wflag && fs->winsect >= fs->fatbase + map->next
+          && fs->winsect < fs->fatbase + map->next + n)
+        memcpy(chunk + (fs->winsect - fs->fatbase - map->next) * FF_MAX_SS, fs->win, FF_MAX_SS);
+
+      clst = map->next * per_sector;
+      end = clst + n * per_sector;
+      if (end > fs->n_fatent)
+        end = fs->n_fatent;
+      for (p = chunk, i = 0; clst < end; clst++, i++)
+        {
+          DWORD val = (fs->fs_type == FS_FAT16)
+            ? (DWORD)p[i * 2] | (DWORD)p[i * 2 + 1] << 8
+            : ((DWORD)p[i * 4] | (DWORD)p[i * 4 + 1] << 8
+               | (DWORD)p[i * 4 + 2] << 16 | (DWORD)p[i * 4 + 3] << 24) & 0x0FFFFFFF;
+          if (val == 0 && clst >= 2)
+            {
+              map->bits[clst / 32] |= 1u << (clst % 32);
+              map->nfree++;
+            }
+        }
+      map->next += n;
+      max_sectors -= n;
+      map->done = map->next == nsectors;
+    }
+  return map->failed ? -1 : map->done;
+}
+
+/* Get the map for fs if it is complete, or NULL to leave it to FatFs. */
+static struct freemap *complete_freemap(FATFS *fs)
+{
+  struct freemap *map = get_freemap(fs);
+  if (map == NULL || map->failed || !map->done)
+    return NULL;
+  return map;
+}
+
+int _freemap_build(FATFS *fs, unsigned max_sectors)
+{
+  struct freemap *map = get_freemap(fs);
+  if (map == NULL)
+    return -1;
+  return build_step(map, max_sectors);
+}
+
+DWORD ff_freemap_find(FATFS *fs, DWORD scl)
+{
+  struct freemap *map = complete_freemap(fs);
+  DWORD clst, w, bits, i, nwords;
+
+  if (map == NULL)
+    return 0xFFFFFFFF;
+  if (map->nfree == 0)
+    return 0;
+  nwords = (fs->n_fatent + 31) / 32;
+  clst = scl + 1;
+  if (clst >= fs->n_fatent)
+    clst = 2;
+  /* Bits for clusters 0, 1 and past the end are never set, so the first set
+     bit from clst onwards, wrapping once, is the answer. */
+  for (i = 0; i <= nwords; i++)
+    {
+      w = clst / 32;
+      bits = map->bits[w] & (0xFFFFFFFFu << (clst % 32));
+      if (bits)
+        return w * 32 + __builtin_ctz(bits);
+      clst = (w + 1) * 32;
+      if (clst >= fs->n_fatent)
+        clst = 0;
+    }
+  return 0;
+}
+
+DWORD ff_freemap_count(FATFS *fs)
+{
+  struct freemap *map = complete_freemap(fs);
+  return map ? map->nfree : 0xFFFFFFFF;
+}
+
+#if FF_USE_EXPAND
+/* Are clusters c to c + n - 1 all free? */
+static bool run_free(const uint32_t *bits, DWORD c, DWORD n)
+{
+  while (n > 0)
+    {
+      DWORD bit = c % 32, len = 32 - bit;
+      uint32_t mask;
+      if (len > n)
+        len = n;
+      mask = (len == 32) ? 0xFFFFFFFFu : ((1u << len) - 1) << bit;
+      if ((bits[c / 32] & mask) != mask)
+        return false;
+      c += len;
+      n -= len;
+    }
+  return true;
+}
+
+/* First run of n free clusters starting in [c, end), or 0. */
+static DWORD first_run(const uint32_t *bits, DWORD c, DWORD end, DWORD n)
+{
+  DWORD start = c, len = 0;
+  while (c < end)
+    {
+      if (c % 32 == 0 && bits[c / 32] == 0)
+        {
+          c += 32;
+          len = 0;
+          continue;
+        }
+      if (bits[c / 32] & (1u << (c % 32)))
+        {
+          if (len++ == 0)
+            start = c;
+          if (len == n)
+            return start;
+        }
+      else
+        len = 0;
+      c++;
+    }
+  return 0;
+}
+
+DWORD ff_freemap_find_run(FATFS *fs, DWORD scl, DWORD ncl)
+{
+  struct freemap *map = complete_freemap(fs);
+  DWORD au = 1, step, first, c, i, ncand, clst;
+
+  if (map == NULL)
+    return 0xFFFFFFFF;
+  if (ncl > map->nfree || ncl > fs->n_fatent - 2)
+    return 0;
+  if (scl < 2 || scl >= fs->n_fatent)
+    scl = 2;
+
+  /* Clusters per erase block, and the first cluster that starts one. */
+  if (disk_ioctl(fs->pdrv, GET_BLOCK_SIZE, &au) != RES_OK || au == 0)
+    au = 1;
+  step = au / fs->csize;
+  for (first = 2; step > 1 && first < 2 + step; first++)
+    if ((fs->database + (LBA_t)(first - 2) * fs->csize) % au == 0)
+      break;
+  if (step > 1 && first < 2 + step && first < fs->n_fatent)
+    {
+      /* Aligned candidates from scl onwards, wrapping once. */
+      ncand = (fs->n_fatent - first + step - 1) / step;
+      i = (scl <= first) ? 0 : (scl - first + step - 1) / step;
+      for (; ncand > 0; ncand--, i++)
+        {
+          if (first + i * step >= fs->n_fatent)
+            i = 0;
+          c = first + i * step;
+          if (c + ncl <= fs->n_fatent && run_free(map->bits, c, ncl))
+            return c;
+        }
+    }
+
+  /* Any run will do. */
+  clst = first_run(map->bits, scl, fs->n_fatent, ncl);
+  if (clst == 0 && scl > 2)
+    clst = first_run(map->bits, 2, scl + ncl - 1 < fs->n_fatent ? scl + ncl - 1 : fs->n_fatent, ncl);
+  return clst;
+}
+#endif
+
+void ff_freemap_put(FATFS *fs, DWORD clst, DWORD val)
+{
+  struct freemap *map = get_freemap(fs);
+  uint32_t mask;
+  bool was_free, is_free;
+
+  /* Entries the build has not reached yet are read from the FAT later. */
+  if (map == NULL || map->failed
+      || clst / ((fs->fs_type == FS_FAT16) ? FF_MAX_SS / 2 : FF_MAX_SS / 4) >= map->next)
+    return;
+  mask = 1u << (clst % 32);
+  was_free = (map->bits[clst / 32] & mask) != 0;
+  is_free = (val & 0x0FFFFFFF) == 0;
+  if (is_free && !was_free)
+    {
+      map->bits[clst / 32] |= mask;
+      map->nfree++;
+    }
+  else if (!is_free && was_free)
+    {
+      map->bits[clst / 32] &= ~mask;
+      map->nfree--;
+    }
+}
+#endif
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+#include "nextp8.h"
+
+#ifndef ROM
+/* Housekeeping for idle moments, to be called from the main loop: drain
+   the trace ring, send queued serial output, flush logs that are due and
+   draw pending console output. If the SD card is mounted, _fatfs_idle()
+   then does its share; nothing here mounts it. */
+void _idle(void)
+{
+  _trace_poll();
+  _uart_poll();
+  _log_poll();
+  _console_poll();
+  _fatfs_idle();
+}
+#endif
@@ -12,10 +12,19 @@
  * they apply.
  */
 
+#include <errno.h>
+#include <stddef.h>
 #include "io.h"
 
 int access(const char *pathname, int mode)
 {
-  _init_fatfs();
-  return _fatfs_access(pathname, mode);
+  const struct _fs_ops *ops = _vfs_lookup(&pathname);
+  if (ops == NULL)
+    return -1;
+  if (ops->access == NULL)
+    {
+      errno = ENOSYS;
+      return -1;
+    }
+  return ops->access(pathname, mode);
 }
@@ -32,17 +32,15 @@ int close (int fd)
 {
   int ret;
   _init_stdio();
-  if (fd < 0 || fd >= _NR_FILES || _files[fd].ops == NULL)
+  struct _file *file = _get_file(fd);
+  if (file == NULL)
+    return -1;
+  if (file->ops->close != NULL)
     {
-      errno = EBADF;
-      return -1;
-    }
-  if (_files[fd].ops->close != NULL)
-    {
-      ret = _files[fd].ops->close(&_files[fd]);
+      ret = file->ops->close(file);
       if (ret != 0)
         return ret;
     }
-  _files[fd].ops = NULL;
+  _free_file(fd);
   return 0;
 }
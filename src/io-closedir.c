@@ -18,5 +18,5 @@
 
 int closedir(DIR *dirp)
 {
-  return _fatfs_closedir(dirp);
+  return _vfs_closedir(dirp);
 }
\ No newline at end of file
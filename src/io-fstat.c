@@ -34,15 +34,13 @@
 int fstat (int fd, struct stat *buf)
 {
   _init_stdio();
-  if (fd < 0 || fd >= _NR_FILES || _files[fd].ops == NULL)
-    {
-      errno = EBADF;
-      return -1;
-    }
-  if (_files[fd].ops->fstat == NULL)
+  struct _file *file = _get_file(fd);
+  if (file == NULL)
+    return -1;
+  if (file->ops->fstat == NULL)
     {
       errno = EINVAL;
       return -1;
     }
-  return _files[fd].ops->fstat(&_files[fd], buf);
+  return file->ops->fstat(file, buf);
 }
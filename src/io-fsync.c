@@ -0,0 +1,39 @@
+/*
+ * io-fsync.c -- 
+ *
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include "io.h"
+
+/*
+ * fsync -- commit a file's data and directory entry to the card.
+ * input parameters:
+ *   0 : file descriptor
+ * output parameters:
+ *   0 : result
+ *   1 : errno
+ */
+
+int fsync (int fd)
+{
+  _init_stdio();
+  struct _file *file = _get_file(fd);
+  if (file == NULL)
+    return -1;
+  if (file->ops->fsync == NULL)
+    return 0;
+  return file->ops->fsync(file);
+}
@@ -31,15 +31,13 @@
 int isatty (int fd)
 {
   _init_stdio();
-  if (fd < 0 || fd >= _NR_FILES || _files[fd].ops == NULL)
-    {
-      errno = EBADF;
-      return -1;
-    }
-  if (_files[fd].ops->isatty == NULL)
+  struct _file *file = _get_file(fd);
+  if (file == NULL)
+    return -1;
+  if (file->ops->isatty == NULL)
     {
       errno = ENOTTY;
       return  -1;
     }
-  return _files[fd].ops->isatty(&_files[fd]);
+  return file->ops->isatty(file);
 }
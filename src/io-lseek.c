@@ -36,15 +36,13 @@
 off_t lseek (int fd, off_t offset, int whence)
 {
   _init_stdio();
-  if (fd < 0 || fd >= _NR_FILES || _files[fd].ops == NULL)
-    {
-      errno = EBADF;
-      return -1;
-    }
-  if (_files[fd].ops->lseek == NULL)
+  struct _file *file = _get_file(fd);
+  if (file == NULL)
+    return -1;
+  if (file->ops->lseek == NULL)
     {
       errno = EINVAL;
       return -1;
     }
-  return _files[fd].ops->lseek(&_files[fd], offset, whence);
+  return file->ops->lseek(file, offset, whence);
 }
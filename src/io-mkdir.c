@@ -13,9 +13,19 @@
  */
 
 #include <sys/stat.h>
+#include <errno.h>
+#include <stddef.h>
 #include "io.h"
 
 int mkdir(const char *pathname, mode_t mode)
 {
-  return _fatfs_mkdir(pathname, mode);
+  const struct _fs_ops *ops = _vfs_lookup(&pathname);
+  if (ops == NULL)
+    return -1;
+  if (ops->mkdir == NULL)
+    {
+      errno = ENOSYS;
+      return -1;
+    }
+  return ops->mkdir(pathname, mode);
 }
\ No newline at end of file
@@ -40,27 +40,31 @@ int open (const char *fname, int flags, ...)
 {
   va_list ap;
   int fd, ret, mode;
-  uintptr_t data;
+  struct _file *file;
+  const struct _fs_ops *ops;
 
   va_start (ap, flags);
   mode = va_arg(ap, int);
   va_end(ap);
 
   _init_stdio();
-  _init_fatfs();
 
-  for (fd=0;fd<_NR_FILES;++fd)
+  ops = _vfs_lookup(&fname);
+  if (ops == NULL)
+    return -1;
+  if (ops->open == NULL)
     {
-      if (_files[fd].ops == NULL)
-        break;
-    }
-  if (fd == _NR_FILES)
-    {
-      errno = ENFILE;
+      errno = ENOSYS;
       return -1;
     }
-  ret = _fatfs_open(&_files[fd], fname, flags, mode);
+  fd = _alloc_file(&file);
+  if (fd < 0)
+    return -1;
+  ret = ops->open(file, fname, flags, mode);
   if (ret != 0)
-    return ret;
+    {
+      _free_file(fd);
+      return ret;
+    }
   return fd;
 }
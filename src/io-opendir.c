@@ -18,6 +18,5 @@
 
 DIR *opendir(const char *name)
 {
-  _init_fatfs();
-  return _fatfs_opendir(name);
+  return _vfs_opendir(name);
 }
\ No newline at end of file
@@ -34,15 +34,22 @@
 ssize_t read (int fd, void *buf, size_t count)
 {
   _init_stdio();
-  if (fd < 0 || fd >= _NR_FILES || _files[fd].ops == NULL)
+  struct _file *file = _get_file(fd);
+  if (file == NULL)
+    return -1;
+  if (file->ops->read == NULL)
     {
-      errno = EBADF;
+      errno = EINVAL;
       return -1;
     }
-  if (_files[fd].ops->read == NULL)
+#ifndef ROM
+  if (file->sum_type != 0)
     {
-      errno = EINVAL;
-      return -1;
+      ssize_t ret = file->ops->read(file, buf, count);
+      if (ret > 0)
+        _checksum_update(file, buf, ret);
+      return ret;
     }
-  return _files[fd].ops->read(&_files[fd], buf, count);
+#endif
+  return file->ops->read(file, buf, count);
 }
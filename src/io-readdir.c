@@ -18,5 +18,5 @@
 
 struct dirent *readdir(DIR *dirp)
 {
-  return _fatfs_readdir(dirp);
+  return _vfs_readdir(dirp);
 }
\ No newline at end of file
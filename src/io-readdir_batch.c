@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+#include <sys/types.h>
+#include <dirent.h>
+#include "io.h"
+
+/*
+ * _readdir_batch -- read up to max_entries directory entries in one call
+ *
+ * Names are packed into the names buffer. If ext is not NULL only files
+ * with that extension are returned; directories are always returned.
+ * Returns the number of entries filled in, 0 at the end of the directory,
+ * or -1 on error.
+ */
+
+int _readdir_batch(DIR *dirp, struct _dirent_entry *entries, int max_entries,
+                   char *names, size_t names_size, const char *ext, int flags)
+{
+  return _vfs_readdir_batch(dirp, entries, max_entries, names, names_size, ext, flags);
+}
@@ -0,0 +1,82 @@
+/*
+ * io-readv.c -- 
+ *
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include "io.h"
+
+/*
+ * readv -- read from a file descriptor into several buffers
+ * input parameters:
+ *   0 : file descriptor
+ *   1 : iovec array
+ *   2 : iovec count
+ * output parameters:
+ *   0 : result
+ *   1 : errno
+ */
+
+ssize_t readv (int fd, const struct iovec *iov, int iovcnt)
+{
+  _init_stdio();
+  struct _file *file = _get_file(fd);
+  ssize_t total = 0;
+  int i;
+  if (file == NULL)
+    return -1;
+  if (_check_iovec(iov, iovcnt) != 0)
+    return -1;
+  if (file->ops->readv != NULL)
+    total = file->ops->readv(file, iov, iovcnt);
+  else if (file->ops->read == NULL)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  else
+    {
+      for (i = 0; i < iovcnt; i++)
+        {
+          ssize_t n;
+          if (iov[i].iov_len == 0)
+            continue;
+          n = file->ops->read(file, iov[i].iov_base, iov[i].iov_len);
+          if (n < 0)
+            {
+              if (total == 0)
+                return -1;
+              break;
+            }
+          total += n;
+          if ((size_t)n < iov[i].iov_len)
+            break;
+        }
+    }
+#ifndef ROM
+  if (file->sum_type != 0 && total > 0)
+    {
+      size_t left = total;
+      for (i = 0; left > 0; i++)
+        {
+          size_t n = iov[i].iov_len < left ? iov[i].iov_len : left;
+          _checksum_update(file, iov[i].iov_base, n);
+          left -= n;
+        }
+    }
+#endif
+  return total;
+}
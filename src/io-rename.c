@@ -34,5 +34,18 @@
 
 int _rename (const char *oldpath, const char *newpath)
 {
-  return _fatfs_rename(oldpath, newpath);
+  const struct _fs_ops *ops = _vfs_lookup(&oldpath);
+  if (ops == NULL)
+    return -1;
+  if (_vfs_lookup(&newpath) != ops)
+    {
+      errno = EXDEV;
+      return -1;
+    }
+  if (ops->rename == NULL)
+    {
+      errno = ENOSYS;
+      return -1;
+    }
+  return ops->rename(oldpath, newpath);
 }
@@ -36,5 +36,14 @@
 
 int stat (const char *__restrict filename, struct stat *__restrict buf)
 {
-  return _fatfs_stat(filename, buf);
+  const char *path = filename;
+  const struct _fs_ops *ops = _vfs_lookup(&path);
+  if (ops == NULL)
+    return -1;
+  if (ops->stat == NULL)
+    {
+      errno = ENOSYS;
+      return -1;
+    }
+  return ops->stat(path, buf);
 }
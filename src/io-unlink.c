@@ -32,5 +32,13 @@
 
 int unlink (const char *path)
 {
-  return _fatfs_unlink(path);
+  const struct _fs_ops *ops = _vfs_lookup(&path);
+  if (ops == NULL)
+    return -1;
+  if (ops->unlink == NULL)
+    {
+      errno = ENOSYS;
+      return -1;
+    }
+  return ops->unlink(path);
 }
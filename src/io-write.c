@@ -34,15 +34,13 @@
 ssize_t write (int fd, const void *buf, size_t count)
 {
   _init_stdio();
-  if (fd < 0 || fd >= _NR_FILES || _files[fd].ops == NULL)
-    {
-      errno = EBADF;
-      return -1;
-    }
-  if (_files[fd].ops->write == NULL)
+  struct _file *file = _get_file(fd);
+  if (file == NULL)
+    return -1;
+  if (file->ops->write == NULL)
     {
       errno = EINVAL;
       return -1;
     }
-  return _files[fd].ops->write(&_files[fd], buf, count);
+  return file->ops->write(file, buf, count);
 }
@@ -0,0 +1,63 @@
+/*
+ * io-writev.c -- 
+ *
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include "io.h"
+
+/*
+ * writev -- write to a file descriptor from several buffers
+ * input parameters:
+ *   0 : file descriptor
+ *   1 : iovec array
+ *   2 : iovec count
+ * output parameters:
+ *   0 : result
+ *   1 : errno
+ */
+
+ssize_t writev (int fd, const struct iovec *iov, int iovcnt)
+{
+  _init_stdio();
+  struct _file *file = _get_file(fd);
+  ssize_t total = 0;
+  int i;
+  if (file == NULL)
+    return -1;
+  if (_check_iovec(iov, iovcnt) != 0)
+    return -1;
+  if (file->ops->writev != NULL)
+    return file->ops->writev(file, iov, iovcnt);
+  if (file->ops->write == NULL)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  for (i = 0; i < iovcnt; i++)
+    {
+      ssize_t n;
+      if (iov[i].iov_len == 0)
+        continue;
+      n = file->ops->write(file, iov[i].iov_base, iov[i].iov_len);
+      if (n < 0)
+        return total > 0 ? total : -1;
+      total += n;
+      if ((size_t)n < iov[i].iov_len)
+        break;
+    }
+  return total;
+}
@@ -12,6 +12,129 @@
  * they apply.
  */
 
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
 #include "io.h"
 
-struct _file _files[_NR_FILES];
+#ifndef SSIZE_MAX
+#define SSIZE_MAX LONG_MAX
+#endif
+
+#ifdef ROM
+static struct _file files[_NR_FILES];
+static struct _file *file_table[_NR_FILES];
+struct _file **_files = file_table;
+int _nr_files = _NR_FILES;
+#else
+struct _file **_files;
+int _nr_files;
+#endif
+
+/*
+ * _get_file -- look up an open file descriptor
+ */
+
+struct _file *_get_file(int fd)
+{
+  if (fd < 0 || fd >= _nr_files || _files[fd] == NULL || _files[fd]->ops == NULL)
+    {
+      errno = EBADF;
+      return NULL;
+    }
+  return _files[fd];
+}
+
+/*
+ * _alloc_file -- allocate a file object and the lowest free descriptor
+ *
+ * The new object is zeroed; the caller must set its ops before the
+ * descriptor is usable, or release it with _free_file.
+ */
+
+int _alloc_file(struct _file **filep)
+{
+  int fd;
+  struct _file *file;
+
+  for (fd=0;fd<_nr_files;++fd)
+    {
+      if (_files[fd] == NULL)
+        break;
+    }
+#ifdef ROM
+  if (fd == _nr_files)
+    {
+      errno = ENFILE;
+      return -1;
+    }
+  file = &files[fd];
+  memset(file, 0, sizeof(*file));
+#else
+  if (fd == _nr_files)
+    {
+      struct _file **new_files = realloc(_files, (_nr_files + _FILES_GROW) * sizeof(*_files));
+      if (new_files == NULL)
+        {
+          errno = ENOMEM;
+          return -1;
+        }
+      memset(new_files + _nr_files, 0, _FILES_GROW * sizeof(*_files));
+      _files = new_files;
+      _nr_files += _FILES_GROW;
+    }
+  file = calloc(1, sizeof(*file));
+  if (file == NULL)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+#endif
+  _files[fd] = file;
+  *filep = file;
+  return fd;
+}
+
+/*
+ * _free_file -- release a descriptor and its file object
+ */
+
+void _free_file(int fd)
+{
+  if (fd < 0 || fd >= _nr_files)
+    return;
+#ifndef ROM
+  free(_files[fd]);
+#endif
+  _files[fd] = NULL;
+}
+
+/*
+ * _check_iovec -- validate the arguments of readv and writev
+ *
+ * The total length must fit in the ssize_t the call returns.
+ */
+
+int _check_iovec(const struct iovec *iov, int iovcnt)
+{
+  size_t total = 0;
+  int i;
+
+  if (iovcnt < 0 || iovcnt > IOV_MAX)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  for (i=0;i<iovcnt;++i)
+    {
+      if (iov[i].iov_len > SSIZE_MAX - total)
+        {
+          errno = EINVAL;
+          return -1;
+        }
+      total += iov[i].iov_len;
+    }
+  return 0;
+}
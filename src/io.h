@@ -23,13 +23,19 @@
 #include <sys/types.h>
 #include "ff.h"
 
+/* The ROM build has a fixed table of descriptors. The RAM build allocates
+   file objects on demand and grows the descriptor table as needed. */
 #ifdef ROM
 #define _NR_FILES 4
 #else
-#define _NR_FILES 8
+#define _FILES_GROW 8
 #endif
 
 struct _file;
+struct _dirent_entry;
+struct iovec;
+struct _p8z;
+struct _ramfs_node;
 
 struct _file_ops {
   int (*close)(struct _file *file);
@@ -38,14 +44,39 @@ struct _file_ops {
   off_t (*lseek)(struct _file *file, off_t offset, int whence);
   ssize_t (*read)(struct _file *file, void *buf, size_t count);
   ssize_t (*write)(struct _file *file, const void *buf, size_t count);
+  int (*fsync)(struct _file *file);     /* optional, NULL: nothing to sync */
+  /* Optional. readv() and writev() fall back to read and write. */
+  ssize_t (*readv)(struct _file *file, const struct iovec *iov, int iovcnt);
+  ssize_t (*writev)(struct _file *file, const struct iovec *iov, int iovcnt);
 };
 
 struct _file {
   struct _file_ops *ops;
+  int flags;            /* open() flags */
   union {
     int stdio;
     FIL fil;
+#ifndef ROM
+    struct {
+      FIL fil;          /* copy of the pack file's object */
+      FSIZE_t base;     /* offset of the member in the pack file */
+      FSIZE_t size;
+      FSIZE_t pos;
+    } pack;
+    struct {
+      struct _ramfs_node *node;
+      off_t pos;
+      uint32_t block;   /* block holding block_pos (RAMFS_NO_BLOCK: none) */
+      off_t block_pos;  /* file offset of the start of block */
+      unsigned short truncs;
+    } ram;
+#endif
   };
+#ifndef ROM
+  struct _p8z *p8z;     /* decompression state, see fatfs_p8z.c */
+  int sum_type;         /* _CHECKSUM_* kept over data read, 0: none */
+  uint32_t sum;
+#endif
 };
 
 extern void _init_stdio();
@@ -59,8 +90,81 @@ extern int _fatfs_stat (const char *__restrict filename, struct stat *__restrict
 extern int _fatfs_unlink(const char *path);
 extern DIR *_fatfs_opendir(const char *name);
 extern struct dirent *_fatfs_readdir(DIR *dirp);
+extern int _fatfs_readdir_batch(DIR *dirp, struct _dirent_entry *entries, int max_entries,
+                                char *names, size_t names_size, const char *ext, int flags);
 extern int _fatfs_closedir(DIR *dirp);
+extern int fresult2errno(FRESULT fr);
+#ifndef ROM
+extern int _freemap_build(FATFS *fs, unsigned max_sectors);
+extern int _p8z_name(const char *filename);
+extern int _p8z_open(struct _file *file);
+extern void _checksum_update(struct _file *file, const void *buf, size_t len);
+extern void _console_write(const void *buf, size_t count);
+
+/* Nesting of BSP interrupt handlers (vblank.c). */
+extern volatile int _interrupt_depth;
+
+static inline unsigned short _irq_disable(void)
+{
+  unsigned short sr;
+  __asm__ __volatile__ ("move.w %%sr,%0\n\tori.w #0x0700,%%sr"
+                        : "=d" (sr) : : "memory");
+  return sr;
+}
+
+static inline void _irq_restore(unsigned short sr)
+{
+  __asm__ __volatile__ ("move.w %0,%%sr" : : "d" (sr) : "memory");
+}
+#endif
+
+extern struct _file_ops _fatfs_ops;
+
+#ifndef ROM
+extern int _match_ext(const char *name, const char *ext);
+extern void _sort_dirent_entries(struct _dirent_entry *entries, int n, int flags);
+#endif
+
+/* A file system in the mount table (vfs.c). Paths are relative to the
+   mount point. Operations left NULL fail with ENOSYS. */
+struct _fs_ops {
+  void (*init)(void);   /* called before every operation, may be NULL */
+  int (*open)(struct _file *file, const char *filename, int flags, mode_t mode);
+  int (*access)(const char *pathname, int mode);
+  int (*stat)(const char *__restrict filename, struct stat *__restrict buf);
+  int (*unlink)(const char *path);
+  int (*rename)(const char *oldpath, const char *newpath);
+  int (*mkdir)(const char *pathname, mode_t mode);
+  DIR *(*opendir)(const char *name);
+  struct dirent *(*readdir)(DIR *dirp);
+  int (*readdir_batch)(DIR *dirp, struct _dirent_entry *entries, int max_entries,
+                       char *names, size_t names_size, const char *ext, int flags);
+  int (*closedir)(DIR *dirp);
+};
+
+extern const struct _fs_ops _fatfs_fs_ops;
+#ifndef ROM
+extern const struct _fs_ops _ramfs_fs_ops;
+#endif
+
+/* Find the file system for *path and advance *path past its mount point. */
+extern const struct _fs_ops *_vfs_lookup(const char **path);
+#ifndef ROM
+extern int _vfs_mount(const char *prefix, const struct _fs_ops *ops);
+extern int _vfs_unmount(const char *prefix);
+#endif
+extern DIR *_vfs_opendir(const char *name);
+extern struct dirent *_vfs_readdir(DIR *dirp);
+extern int _vfs_readdir_batch(DIR *dirp, struct _dirent_entry *entries, int max_entries,
+                              char *names, size_t names_size, const char *ext, int flags);
+extern int _vfs_closedir(DIR *dirp);
+
+extern struct _file **_files;
+extern int _nr_files;
 
-extern struct _file _files[_NR_FILES];
+extern struct _file *_get_file(int fd);
+extern int _check_iovec(const struct iovec *iov, int iovcnt);
+extern int _alloc_file(struct _file **filep);
+extern void _free_file(int fd);
 
 #endif
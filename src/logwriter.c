@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* Buffered append writer for log and save files.
+ *
+ * Each write() of a few bytes to a FatFs file dirties the sector buffer and
+ * usually costs a card round trip, and every f_sync() also rewrites the
+ * directory entry and the FAT. A log collects its appends in a ring buffer
+ * allocated when it is opened. Once the ring is half full, the data up to
+ * the last multiple of the log's write unit, the largest power of two that
+ * fits in half the ring, is written in one go; the rest stays in the ring.
+ * The card only ever sees whole sectors, and as its allocation units are
+ * powers of two too, the writes tile them instead of ending part way
+ * through a different one each time. Whatever is left is written and the
+ * file synced when the log is flushed: by _log_flush(), by _log_poll() once
+ * the oldest data has waited flush_ms, and by _exit() and _fatal_error()
+ * through _log_flush_all(). */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "mmio.h"
+#include "nextp8.h"
+
+#ifndef ROM
+#define LOG_MAX 4
+#define LOG_SECTOR_SIZE 512
+#define LOG_DEFAULT_SIZE 4096
+
+struct log {
+  int fd;               /* -1: slot unused */
+  char *buf;
+  size_t size;          /* a multiple of LOG_SECTOR_SIZE */
+  size_t unit;          /* write unit, a power of two */
+  size_t head;          /* ring offset of the oldest buffered byte */
+  size_t count;         /* bytes buffered */
+  off_t pos;            /* file offset of the oldest buffered byte */
+  uint64_t since;       /* _UTIMER_1MHZ when the ring last became non-empty */
+  uint64_t flush_us;    /* 0: no timed flush */
+};
+
+static struct log logs[LOG_MAX] = {
+  [0 ... LOG_MAX - 1] = { .fd = -1 },
+};
+
+static struct log *get_log(int log)
+{
+  if (log < 0 || log >= LOG_MAX || logs[log].fd < 0)
+    {
+      errno = EBADF;
+      return NULL;
+    }
+  return &logs[log];
+}
+
+/* Write the oldest count bytes in the ring. */
+static int drain(struct log *l, size_t count)
+{
+  while (count > 0)
+    {
+      struct iovec iov[2];
+      size_t first = l->size - l->head;
+      ssize_t n;
+      int iovcnt = 1;
+      if (first >= count)
+        first = count;
+      else
+        {
+          iov[1].iov_base = l->buf;
+          iov[1].iov_len = count - first;
+          iovcnt = 2;
+        }
+      iov[0].iov_base = l->buf + l->head;
+      iov[0].iov_len = first;
+      n = writev(l->fd, iov, iovcnt);
+      if (n <= 0)
+        {
+          if (n == 0)
+            errno = ENOSPC;
+          return -1;
+        }
+      l->head = (l->head + n) % l->size;
+      l->count -= n;
+      l->pos += n;
+      count -= n;
+    }
+  return 0;
+}
+
+/* Write the buffered data that ends on a write unit boundary. */
+static int drain_units(struct log *l)
+{
+  off_t end = (l->pos + l->count) & ~(off_t)(l->unit - 1);
+  if (end <= l->pos)
+    return 0;
+  return drain(l, end - l->pos);
+}
+
+static int flush(struct log *l)
+{
+  if (l->count > 0 && drain(l, l->count) != 0)
+    return -1;
+  return fsync(l->fd);
+}
+
+int _log_open(const char *path, size_t size, unsigned flush_ms)
+{
+  struct log *l;
+  int log;
+  for (log = 0; log < LOG_MAX; log++)
+    {
+      if (logs[log].fd < 0)
+        break;
+    }
+  if (log == LOG_MAX)
+    {
+      errno = EMFILE;
+      return -1;
+    }
+  l = &logs[log];
+  if (size == 0)
+    size = LOG_DEFAULT_SIZE;
+  size = (size + LOG_SECTOR_SIZE - 1) & ~(size_t)(LOG_SECTOR_SIZE - 1);
+  l->buf = malloc(size);
+  if (l->buf == NULL)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+  l->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0666);
+  if (l->fd < 0)
+    {
+      free(l->buf);
+      return -1;
+    }
+  l->pos = lseek(l->fd, 0, SEEK_END);
+  if (l->pos < 0)
+    {
+      close(l->fd);
+      free(l->buf);
+      l->fd = -1;
+      return -1;
+    }
+  l->size = size;
+  for (l->unit = LOG_SECTOR_SIZE; l->unit * 2 <= size / 2; l->unit *= 2)
+    ;
+  l->head = 0;
+  l->count = 0;
+  l->flush_us = (uint64_t)flush_ms * 1000;
+  return log;
+}
+
+ssize_t _log_write(int log, const void *buf, size_t count)
+{
+  struct log *l = get_log(log);
+  const char *p = buf;
+  size_t left = count;
+  if (l == NULL)
+    return -1;
+  if (count > l->size - l->count)
+    {
+      if (drain_units(l) != 0)
+        return -1;
+      if (count > l->size - l->count)
+        {
+          /* Still no room: write out the rest of the ring, and if the data
+             would not fit in an empty ring either, write that directly. */
+          if (drain(l, l->count) != 0)
+            return -1;
+          if (count > l->size)
+            {
+              ssize_t n = write(l->fd, buf, count);
+              if (n > 0)
+                l->pos += n;
+              return n;
+            }
+        }
+    }
+  if (l->count == 0)
+    l->since = MMIO_REG64(_UTIMER_1MHZ);
+  while (left > 0)
+    {
+      size_t tail = (l->head + l->count) % l->size;
+      size_t n = l->size - tail;
+      if (n > left)
+        n = left;
+      memcpy(l->buf + tail, p, n);
+      l->count += n;
+      p += n;
+      left -= n;
+    }
+  if (l->count >= l->size / 2 && drain_units(l) != 0)
+    return -1;
+  if (l->flush_us != 0 && l->count > 0
+      && MMIO_REG64(_UTIMER_1MHZ) - l->since >= l->flush_us
+      && flush(l) != 0)
+    return -1;
+  return count;
+}
+
+int _log_flush(int log)
+{
+  struct log *l = get_log(log);
+  if (l == NULL)
+    return -1;
+  return flush(l);
+}
+
+int _log_close(int log)
+{
+  struct log *l = get_log(log);
+  int ret;
+  if (l == NULL)
+    return -1;
+  ret = flush(l);
+  if (close(l->fd) != 0)
+    ret = -1;
+  free(l->buf);
+  l->buf = NULL;
+  l->fd = -1;
+  return ret;
+}
+
+/* Flush the logs whose oldest data has waited longer than their flush_ms.
+   Called from _idle(), and by applications from their main loop. */
+void _log_poll(void)
+{
+  uint64_t now = MMIO_REG64(_UTIMER_1MHZ);
+  struct log *l;
+  for (l = logs; l < logs + LOG_MAX; l++)
+    {
+      if (l->fd >= 0 && l->flush_us != 0 && l->count > 0
+          && now - l->since >= l->flush_us)
+        flush(l);
+    }
+}
+
+void _log_flush_all(void)
+{
+  static int flushing;
+  struct log *l;
+  /* A failing flush can end in _fatal_error(), which calls us again. */
+  if (flushing)
+    return;
+  flushing = 1;
+  for (l = logs; l < logs + LOG_MAX; l++)
+    {
+      if (l->fd >= 0)
+        flush(l);
+    }
+  flushing = 0;
+}
+#endif
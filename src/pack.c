@@ -0,0 +1,687 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* Read-only pack files, mounted under "pack:" (see vfs.c).
+ *
+ * A game with thousands of small assets would otherwise pay for a FatFs
+ * directory search on every open. _pack_mount(name, path) opens a pack file
+ * (made by tools/p8pack.c) once and keeps its table of contents in RAM.
+ * Its members are then "pack:name/member": opening one is a binary search
+ * of the table, and reading it is a read of one contiguous range of the
+ * pack file through a private copy of the pack's file object. The file is:
+ *
+ *   "P8PK"                 magic
+ *   u32 version            1
+ *   u32 count
+ *   u32 names_size
+ *   entry[count]           sorted by name, compared with strcasecmp()
+ *     u32 name             file offset of the name
+ *     u32 offset           file offset of the data
+ *     u32 length           stored length
+ *     u32 size             uncompressed length
+ *     u32 flags            PACK_LZ4: the data is a .p8z stream
+ *   char names[names_size] '/' separated paths, NUL terminated
+ *   data
+ *
+ * All fields are little endian. Directories are implied by the names. */
+
+#include <sys/types.h>
+#define DIR DIRENT_DIR
+#include <dirent.h>
+#undef DIR
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include "ff.h"
+#include "io.h"
+#include "nextp8.h"
+
+#ifndef ROM
+#define PACK_MAX 4
+#define PACK_MAX_NAME 15
+#define PACK_HEADER_SIZE 16
+#define PACK_LZ4 1
+
+struct pack_entry {
+  uint32_t name;
+  uint32_t offset;
+  uint32_t length;
+  uint32_t size;
+  uint32_t flags;
+};
+
+struct pack {
+  char name[PACK_MAX_NAME + 1];         /* empty if the slot is free */
+  FIL fil;
+  uint32_t count;
+  uint8_t *toc;                         /* header, entries and names */
+  unsigned dirs;                        /* open directories, which use toc */
+};
+
+struct pack_dir {
+  struct pack *pack;    /* NULL: the list of packs */
+  char prefix[FF_MAX_LFN + 1];  /* directory name followed by '/', or "" */
+  size_t prefix_len;
+  uint32_t index;
+  const char *last_subdir;      /* last subdirectory returned */
+  size_t last_subdir_len;
+  bool dotdot_done;
+  struct dirent dirent;
+};
+
+static struct pack packs[PACK_MAX];
+static bool pack_mounted;
+
+static const struct _fs_ops pack_fs_ops;
+
+static struct pack_entry *entry(struct pack *pack, uint32_t i)
+{
+  return (struct pack_entry *)(pack->toc + PACK_HEADER_SIZE) + i;
+}
+
+static const char *entry_name(struct pack *pack, uint32_t i)
+{
+  return (const char *)pack->toc + entry(pack, i)->name;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16
+    | (uint32_t)p[3] << 24;
+}
+
+/* Split "name/member" into the pack and the member path ("" for the pack's
+   root). Sets errno and returns NULL if there is no such pack. An empty
+   path is the list of packs: NULL is returned with *member set to "". */
+static struct pack *find_pack(const char *path, const char **member)
+{
+  const char *end;
+  size_t len;
+  struct pack *pack;
+
+  while (*path == '/')
+    path++;
+  end = strchr(path, '/');
+  len = end ? (size_t)(end - path) : strlen(path);
+  *member = path + len;
+  while (**member == '/')
+    (*member)++;
+  if (len == 0)
+    {
+      errno = EISDIR;
+      return NULL;
+    }
+  for (pack = packs; pack < packs + PACK_MAX; pack++)
+    if (pack->name[0] != '\0' && strncasecmp(pack->name, path, len) == 0
+        && pack->name[len] == '\0')
+      return pack;
+  *member = NULL;
+  errno = ENOENT;
+  return NULL;
+}
+
+/* Index of the first entry not less than key. */
+static uint32_t lower_bound(struct pack *pack, const char *key)
+{
+  uint32_t lo = 0, hi = pack->count;
+  while (lo < hi)
+    {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (strcasecmp(entry_name(pack, mid), key) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+static struct pack_entry *find_member(struct pack *pack, const char *name)
+{
+  uint32_t i = lower_bound(pack, name);
+  if (i < pack->count && strcasecmp(entry_name(pack, i), name) == 0)
+    return entry(pack, i);
+  return NULL;
+}
+
+/* Fill in dir->prefix for a directory of the pack, returning false if there
+   is no such directory. */
+static bool set_prefix(struct pack_dir *dir, const char *name)
+{
+  size_t len = strlen(name);
+  while (len > 0 && name[len - 1] == '/')
+    len--;
+  if (len + 2 > sizeof(dir->prefix))
+    return false;
+  memcpy(dir->prefix, name, len);
+  if (len > 0)
+    dir->prefix[len++] = '/';
+  dir->prefix[len] = '\0';
+  dir->prefix_len = len;
+  dir->index = lower_bound(dir->pack, dir->prefix);
+  return len == 0 || (dir->index < dir->pack->count
+                      && strncasecmp(entry_name(dir->pack, dir->index),
+                                     dir->prefix, len) == 0);
+}
+
+static bool is_dir(struct pack *pack, const char *name)
+{
+  struct pack_dir dir;
+  dir.pack = pack;
+  return set_prefix(&dir, name);
+}
+
+static int pack_close(struct _file *file)
+{
+  return 0;
+}
+
+static int pack_fstat(struct _file *file, struct stat *buf)
+{
+  memset(buf, 0, sizeof(*buf));
+  buf->st_mode = S_IFREG | 0444;
+  buf->st_nlink = 1;
+  buf->st_size = file->pack.size;
+  return 0;
+}
+
+static off_t pack_lseek(struct _file *file, off_t offset, int whence)
+{
+  switch (whence)
+    {
+    case SEEK_SET:
+      break;
+    case SEEK_CUR:
+      offset += file->pack.pos;
+      break;
+    case SEEK_END:
+      offset += file->pack.size;
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+    }
+  if (offset < 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  file->pack.pos = offset;
+  return offset;
+}
+
+static ssize_t pack_read(struct _file *file, void *buf, size_t count)
+{
+  FRESULT res = FR_OK;
+  unsigned bytes_read;
+
+  if (file->pack.pos >= file->pack.size)
+    return 0;
+  if (count > file->pack.size - file->pack.pos)
+    count = file->pack.size - file->pack.pos;
+  if (f_tell(&file->pack.fil) != file->pack.base + file->pack.pos)
+    res = f_lseek(&file->pack.fil, file->pack.base + file->pack.pos);
+  if (res == FR_OK)
+    res = f_read(&file->pack.fil, buf, count, &bytes_read);
+  if (res != FR_OK)
+    {
+      errno = fresult2errno(res);
+      return -1;
+    }
+  file->pack.pos += bytes_read;
+  return bytes_read;
+}
+
+static ssize_t pack_write(struct _file *file, const void *buf, size_t count)
+{
+  errno = EBADF;
+  return -1;
+}
+
+static struct _file_ops pack_ops = {
+    .close = pack_close,
+    .fstat = pack_fstat,
+    .lseek = pack_lseek,
+    .read = pack_read,
+    .write = pack_write,
+};
+
+static int pack_open(struct _file *file, const char *filename, int flags, mode_t mode)
+{
+  const char *name;
+  struct pack *pack = find_pack(filename, &name);
+  struct pack_entry *e;
+
+  if (pack == NULL)
+    return -1;
+  if ((flags & O_ACCMODE) != O_RDONLY || (flags & (O_CREAT | O_TRUNC)))
+    {
+      errno = EROFS;
+      return -1;
+    }
+  e = find_member(pack, name);
+  if (e == NULL)
+    {
+      errno = is_dir(pack, name) ? EISDIR : ENOENT;
+      return -1;
+    }
+  memset(&file->pack, 0, sizeof(file->pack));
+  file->pack.fil.obj = pack->fil.obj;
+  file->pack.fil.flag = FA_READ;
+  file->pack.fil.clust = file->pack.fil.obj.sclust;
+  file->pack.base = e->offset;
+  file->pack.size = e->size;
+  file->flags = flags;
+  if (e->flags & PACK_LZ4)
+    {
+      FRESULT res = f_lseek(&file->fil, e->offset);
+      if (res != FR_OK)
+        {
+          errno = fresult2errno(res);
+          return -1;
+        }
+      return _p8z_open(file);
+    }
+  file->ops = &pack_ops;
+  return 0;
+}
+
+static int pack_access(const char *pathname, int mode)
+{
+  const char *name;
+  struct pack *pack = find_pack(pathname, &name);
+  if (pack == NULL && name == NULL)
+    return -1;
+  if (mode & W_OK)
+    {
+      errno = EROFS;
+      return -1;
+    }
+  if (pack != NULL && find_member(pack, name) == NULL && !is_dir(pack, name))
+    {
+      errno = ENOENT;
+      return -1;
+    }
+  return 0;
+}
+
+static int pack_stat(const char *__restrict filename, struct stat *__restrict buf)
+{
+  const char *name;
+  struct pack *pack = find_pack(filename, &name);
+  struct pack_entry *e = NULL;
+  if (pack == NULL && name == NULL)
+    return -1;
+  if (pack != NULL && (e = find_member(pack, name)) == NULL && !is_dir(pack, name))
+    {
+      errno = ENOENT;
+      return -1;
+    }
+  memset(buf, 0, sizeof(*buf));
+  buf->st_nlink = 1;
+  if (e != NULL)
+    {
+      buf->st_mode = S_IFREG | 0444;
+      buf->st_size = e->size;
+    }
+  else
+    buf->st_mode = S_IFDIR | 0555;
+  return 0;
+}
+
+static int pack_unlink(const char *path)
+{
+  errno = EROFS;
+  return -1;
+}
+
+static int pack_rename(const char *oldpath, const char *newpath)
+{
+  errno = EROFS;
+  return -1;
+}
+
+static int pack_mkdir(const char *pathname, mode_t mode)
+{
+  errno = EROFS;
+  return -1;
+}
+
+static DIR *pack_opendir(const char *dirname)
+{
+  const char *name;
+  struct pack *pack = find_pack(dirname, &name);
+  struct pack_dir *dir;
+
+  if (pack == NULL && name == NULL)
+    return NULL;
+  dir = calloc(1, sizeof(*dir));
+  if (dir == NULL)
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+  dir->pack = pack;
+  if (pack != NULL && !set_prefix(dir, name))
+    {
+      free(dir);
+      errno = (find_member(pack, name) != NULL) ? ENOTDIR : ENOENT;
+      return NULL;
+    }
+  if (pack != NULL)
+    pack->dirs++;
+  return (DIR *)dir;
+}
+
+/* Fill in the next entry of the directory. out->d_name is not terminated
+   at the end of a subdirectory's name, so its length is returned in *len.
+   Returns false at the end. */
+static bool next_entry(struct pack_dir *dir, struct _dirent_entry *out, size_t *len)
+{
+  out->d_date = 0;
+  out->d_time = 0;
+  if (!dir->dotdot_done)
+    {
+      /* Like the SD volumes, every directory has a way back up. */
+      dir->dotdot_done = true;
+      out->d_name = "..";
+      out->d_size = 0;
+      out->d_attrib = AM_DIR;
+      *len = 2;
+      return true;
+    }
+  if (dir->pack == NULL)
+    {
+      /* The list of mounted packs */
+      while (dir->index < PACK_MAX && packs[dir->index].name[0] == '\0')
+        dir->index++;
+      if (dir->index == PACK_MAX)
+        return false;
+      out->d_name = packs[dir->index++].name;
+      out->d_size = 0;
+      out->d_attrib = AM_DIR;
+      *len = strlen(out->d_name);
+      return true;
+    }
+  while (dir->index < dir->pack->count)
+    {
+      const char *name = entry_name(dir->pack, dir->index);
+      const char *slash;
+      if (strncasecmp(name, dir->prefix, dir->prefix_len) != 0)
+        break;
+      name += dir->prefix_len;
+      slash = strchr(name, '/');
+      if (slash == NULL)
+        {
+          out->d_name = name;
+          out->d_size = entry(dir->pack, dir->index)->size;
+          out->d_attrib = AM_RDO;
+          *len = strlen(name);
+          dir->index++;
+          return true;
+        }
+      dir->index++;
+      /* Members of a subdirectory are next to each other, so it is enough
+         to skip the one we returned last. */
+      if (dir->last_subdir != NULL && (size_t)(slash - name) == dir->last_subdir_len
+          && strncasecmp(name, dir->last_subdir, dir->last_subdir_len) == 0)
+        continue;
+      dir->last_subdir = name;
+      dir->last_subdir_len = slash - name;
+      out->d_name = name;
+      out->d_size = 0;
+      out->d_attrib = AM_DIR;
+      *len = slash - name;
+      return true;
+    }
+  return false;
+}
+
+static struct dirent *pack_readdir(DIR *dirp)
+{
+  struct pack_dir *dir = (struct pack_dir *)dirp;
+  struct _dirent_entry e;
+  size_t len;
+
+  if (!next_entry(dir, &e, &len))
+    return NULL;
+  memset(&dir->dirent, 0, sizeof(dir->dirent));
+  if (len > sizeof(dir->dirent.d_name) - 1)
+    len = sizeof(dir->dirent.d_name) - 1;
+  memcpy(dir->dirent.d_name, e.d_name, len);
+  dir->dirent.d_size = e.d_size;
+  dir->dirent.d_attrib = e.d_attrib;
+  return &dir->dirent;
+}
+
+static int pack_readdir_batch(DIR *dirp, struct _dirent_entry *entries, int max_entries,
+                              char *names, size_t names_size, const char *ext, int flags)
+{
+  struct pack_dir *dir = (struct pack_dir *)dirp;
+  int n = 0;
+
+  while (n < max_entries)
+    {
+      struct pack_dir saved = *dir;
+      struct _dirent_entry e;
+      size_t len;
+      if (!next_entry(dir, &e, &len))
+        break;
+      if (strcmp(e.d_name, "..") == 0 && (flags & _READDIR_NO_DOTDOT))
+        continue;
+      if (ext && !(e.d_attrib & AM_DIR) && !_match_ext(e.d_name, ext))
+        continue;
+      len++;
+      if (len > names_size)
+        {
+          /* Leave the entry for the next call. */
+          *dir = saved;
+          if (n > 0)
+            break;
+          errno = EINVAL;
+          return -1;
+        }
+      memcpy(names, e.d_name, len - 1);
+      names[len - 1] = '\0';
+      e.d_name = names;
+      entries[n] = e;
+      names += len;
+      names_size -= len;
+      n++;
+    }
+  _sort_dirent_entries(entries, n, flags);
+  return n;
+}
+
+static int pack_closedir(DIR *dirp)
+{
+  struct pack_dir *dir = (struct pack_dir *)dirp;
+  if (dir->pack != NULL)
+    dir->pack->dirs--;
+  free(dirp);
+  return 0;
+}
+
+static const struct _fs_ops pack_fs_ops = {
+    .open = pack_open,
+    .access = pack_access,
+    .stat = pack_stat,
+    .unlink = pack_unlink,
+    .rename = pack_rename,
+    .mkdir = pack_mkdir,
+    .opendir = pack_opendir,
+    .readdir = pack_readdir,
+    .readdir_batch = pack_readdir_batch,
+    .closedir = pack_closedir,
+};
+
+/* Read and check the table of contents of the pack file open in pack. */
+static int load_toc(struct pack *pack)
+{
+  uint8_t header[PACK_HEADER_SIZE];
+  uint32_t names_size, toc_size, i;
+  unsigned bytes_read;
+  FRESULT res;
+
+  res = f_read(&pack->fil, header, sizeof(header), &bytes_read);
+  if (res != FR_OK)
+    {
+      errno = fresult2errno(res);
+      return -1;
+    }
+  if (bytes_read != sizeof(header) || memcmp(header, "P8PK", 4) != 0
+      || get_le32(header + 4) != 1)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  pack->count = get_le32(header + 8);
+  names_size = get_le32(header + 12);
+  /* Corrupt headers must not make toc_size wrap: the entries and then the
+     names must each fit in what is left of the file. An empty pack has no
+     names at all. */
+  if (pack->count > (f_size(&pack->fil) - PACK_HEADER_SIZE) / sizeof(struct pack_entry)
+      || names_size > f_size(&pack->fil) - PACK_HEADER_SIZE
+                      - pack->count * sizeof(struct pack_entry))
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  toc_size = PACK_HEADER_SIZE + pack->count * sizeof(struct pack_entry) + names_size;
+  pack->toc = malloc(toc_size);
+  if (pack->toc == NULL)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+  memcpy(pack->toc, header, sizeof(header));
+  res = f_read(&pack->fil, pack->toc + PACK_HEADER_SIZE, toc_size - PACK_HEADER_SIZE,
+               &bytes_read);
+  if (res != FR_OK)
+    {
+      errno = fresult2errno(res);
+      return -1;
+    }
+  if (bytes_read != toc_size - PACK_HEADER_SIZE
+      || (names_size > 0 && pack->toc[toc_size - 1] != '\0'))
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  for (i = 0; i < pack->count; i++)
+    {
+      struct pack_entry *e = entry(pack, i);
+      e->name = get_le32((const uint8_t *)&e->name);
+      e->offset = get_le32((const uint8_t *)&e->offset);
+      e->length = get_le32((const uint8_t *)&e->length);
+      e->size = get_le32((const uint8_t *)&e->size);
+      e->flags = get_le32((const uint8_t *)&e->flags);
+      if (e->name < toc_size - names_size || e->name >= toc_size
+          || e->offset > f_size(&pack->fil)
+          || e->length > f_size(&pack->fil) - e->offset
+          || (!(e->flags & PACK_LZ4) && e->length != e->size))
+        {
+          errno = EINVAL;
+          return -1;
+        }
+    }
+  return 0;
+}
+
+/* Make the pack file at path available as "pack:name/". */
+int _pack_mount(const char *name, const char *path)
+{
+  struct pack *pack, *unused = NULL;
+  struct _file file;
+
+  if (name[0] == '\0' || strlen(name) > PACK_MAX_NAME || strchr(name, '/') != NULL)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  for (pack = packs; pack < packs + PACK_MAX; pack++)
+    {
+      if (pack->name[0] != '\0' && strcasecmp(pack->name, name) == 0)
+        {
+          errno = EBUSY;
+          return -1;
+        }
+      if (pack->name[0] == '\0' && unused == NULL)
+        unused = pack;
+    }
+  if (unused == NULL)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+  if (!pack_mounted)
+    {
+      if (_vfs_mount("pack:", &pack_fs_ops) < 0)
+        return -1;
+      pack_mounted = true;
+    }
+
+  _init_fatfs();
+  if (_fatfs_open(&file, path, O_RDONLY, 0) < 0)
+    return -1;
+  if (file.ops != &_fatfs_ops)
+    {
+      /* A .p8z pack: only the raw file can be searched. */
+      file.ops->close(&file);
+      errno = EINVAL;
+      return -1;
+    }
+  unused->fil = file.fil;
+  if (load_toc(unused) < 0)
+    {
+      int err = errno;
+      free(unused->toc);
+      unused->toc = NULL;
+      f_close(&unused->fil);
+      errno = err;
+      return -1;
+    }
+  strcpy(unused->name, name);
+  return 0;
+}
+
+/* Members that are still open stay readable: they have their own copy of
+   the pack's file object. Open directories read the table of contents, so
+   the pack stays mounted (EBUSY) until they are closed. */
+int _pack_unmount(const char *name)
+{
+  struct pack *pack;
+  for (pack = packs; pack < packs + PACK_MAX; pack++)
+    {
+      if (pack->name[0] != '\0' && strcasecmp(pack->name, name) == 0)
+        {
+          if (pack->dirs > 0)
+            {
+              errno = EBUSY;
+              return -1;
+            }
+          f_close(&pack->fil);
+          free(pack->toc);
+          memset(pack, 0, sizeof(*pack));
+          return 0;
+        }
+    }
+  errno = EINVAL;
+  return -1;
+}
+#endif
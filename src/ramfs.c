@@ -0,0 +1,672 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* RAM disk, mounted as "ram:" (see vfs.c).
+ *
+ * Scratch files that do not need to survive a reset live here instead of on
+ * the SD card, so reading and writing them costs a memcpy rather than SPI
+ * transfers. The disk has a single flat directory of up to RAMFS_MAX_FILES
+ * files. Its memory is split into RAMFS_BLOCK_SIZE blocks, and each file is
+ * a chain of blocks linked through next[], much like a FAT. The memory is
+ * taken from above the heap the first time the disk is used, or when
+ * _ramfs_init() is called. */
+
+#include <sys/types.h>
+#define DIR DIRENT_DIR
+#include <dirent.h>
+#undef DIR
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "ff.h"
+#include "io.h"
+#include "nextp8.h"
+
+#ifndef ROM
+#define RAMFS_BLOCK_SIZE 1024
+#define RAMFS_MAX_FILES 32
+#define RAMFS_MAX_NAME 63
+#define RAMFS_NO_BLOCK 0xFFFFFFFFu
+/* Leave this much memory free for the heap when sizing the disk. */
+#define RAMFS_HEAP_RESERVE (256 * 1024)
+
+struct _ramfs_node {
+  char name[RAMFS_MAX_NAME + 1];        /* empty if the slot is free */
+  uint32_t size;
+  uint32_t first;       /* first block, or RAMFS_NO_BLOCK */
+  time_t mtime;
+  unsigned short opens;
+  unsigned short truncs;        /* invalidates cached blocks of open files */
+  bool unlinked;        /* removed while still open */
+  bool modified;
+};
+
+struct ramfs_dir {
+  bool dotdot_done;
+  int index;
+  struct dirent dirent;
+};
+
+static struct _ramfs_node nodes[RAMFS_MAX_FILES];
+static uint8_t *blocks;
+static uint32_t *next;          /* next block in the chain, or RAMFS_NO_BLOCK */
+static uint32_t nblocks;
+static uint32_t free_list = RAMFS_NO_BLOCK;
+static bool initialized;
+
+/* Make a RAM disk of size bytes (0: a quarter of the memory left between
+   the heap and the stack). Returns 0, or -1 if it is already in use or
+   there is not enough memory. */
+int _ramfs_init(size_t size)
+{
+  uint32_t i;
+  uint8_t *mem;
+
+  if (initialized)
+    {
+      errno = EBUSY;
+      return -1;
+    }
+  if (size == 0)
+    {
+      size_t avail = _heap_free();
+      size = avail > RAMFS_HEAP_RESERVE ? (avail - RAMFS_HEAP_RESERVE) / 4 : 0;
+    }
+  nblocks = size / (RAMFS_BLOCK_SIZE + sizeof(uint32_t));
+  if (nblocks == 0)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+  mem = sbrk(nblocks * (RAMFS_BLOCK_SIZE + sizeof(uint32_t)));
+  if (mem == (void *)-1)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+  blocks = mem;
+  next = (uint32_t *)(mem + nblocks * RAMFS_BLOCK_SIZE);
+  for (i = 0; i < nblocks; i++)
+    next[i] = (i + 1 < nblocks) ? i + 1 : RAMFS_NO_BLOCK;
+  free_list = 0;
+  initialized = true;
+  return 0;
+}
+
+static int ramfs_ready(void)
+{
+  return initialized || _ramfs_init(0) == 0;
+}
+
+/* The file name part of a path: "" for the root directory, or NULL if the
+   path names something inside a subdirectory. */
+static const char *ramfs_name(const char *path)
+{
+  while (*path == '/')
+    path++;
+  if (strchr(path, '/') != NULL)
+    return NULL;
+  return path;
+}
+
+static struct _ramfs_node *find_node(const char *name)
+{
+  struct _ramfs_node *node;
+  for (node = nodes; node < nodes + RAMFS_MAX_FILES; node++)
+    if (node->name[0] != '\0' && !node->unlinked && strcasecmp(node->name, name) == 0)
+      return node;
+  return NULL;
+}
+
+/* Look up an existing file, setting errno if there is none. */
+static struct _ramfs_node *lookup(const char *path)
+{
+  const char *name = ramfs_name(path);
+  struct _ramfs_node *node;
+  if (!ramfs_ready())
+    return NULL;
+  if (name == NULL || name[0] == '\0')
+    {
+      errno = name ? EISDIR : ENOENT;
+      return NULL;
+    }
+  node = find_node(name);
+  if (node == NULL)
+    errno = ENOENT;
+  return node;
+}
+
+static void free_chain(uint32_t block)
+{
+  while (block != RAMFS_NO_BLOCK)
+    {
+      uint32_t n = next[block];
+      next[block] = free_list;
+      free_list = block;
+      block = n;
+    }
+}
+
+static void release_node(struct _ramfs_node *node)
+{
+  free_chain(node->first);
+  memset(node, 0, sizeof(*node));
+}
+
+/* The block holding file offset pos. The chain is walked from the last block
+   the file used when that is not past pos, so sequential access is cheap. */
+static uint32_t seek_block(struct _file *file, off_t pos)
+{
+  struct _ramfs_node *node = file->ram.node;
+  uint32_t block;
+  off_t block_pos;
+
+  pos -= pos % RAMFS_BLOCK_SIZE;
+  if (file->ram.block != RAMFS_NO_BLOCK && file->ram.block_pos <= pos
+      && file->ram.truncs == node->truncs)
+    {
+      block = file->ram.block;
+      block_pos = file->ram.block_pos;
+    }
+  else
+    {
+      block = node->first;
+      block_pos = 0;
+    }
+  while (block != RAMFS_NO_BLOCK && block_pos < pos)
+    {
+      block = next[block];
+      block_pos += RAMFS_BLOCK_SIZE;
+    }
+  if (block != RAMFS_NO_BLOCK)
+    {
+      file->ram.block = block;
+      file->ram.block_pos = block_pos;
+      file->ram.truncs = node->truncs;
+    }
+  return block;
+}
+
+/* Make sure the file has blocks for its first size bytes. */
+static int grow(struct _ramfs_node *node, uint32_t size)
+{
+  uint32_t need = (size + RAMFS_BLOCK_SIZE - 1) / RAMFS_BLOCK_SIZE;
+  uint32_t have = 0, last = RAMFS_NO_BLOCK, block;
+
+  /* Count the chain rather than trust the size: a write that ran out of
+     space may have left extra blocks on the end. */
+  if (need <= (node->size + RAMFS_BLOCK_SIZE - 1) / RAMFS_BLOCK_SIZE)
+    return 0;
+  for (block = node->first; block != RAMFS_NO_BLOCK; block = next[block])
+    {
+      last = block;
+      have++;
+    }
+  while (have < need)
+    {
+      if (free_list == RAMFS_NO_BLOCK)
+        {
+          errno = ENOSPC;
+          return -1;
+        }
+      block = free_list;
+      free_list = next[block];
+      next[block] = RAMFS_NO_BLOCK;
+      if (last == RAMFS_NO_BLOCK)
+        node->first = block;
+      else
+        next[last] = block;
+      last = block;
+      have++;
+    }
+  return 0;
+}
+
+static int ramfs_close(struct _file *file)
+{
+  struct _ramfs_node *node = file->ram.node;
+  if (node->modified)
+    {
+      node->mtime = time(NULL);
+      node->modified = false;
+    }
+  if (--node->opens == 0 && node->unlinked)
+    release_node(node);
+  return 0;
+}
+
+static void fill_stat(struct _ramfs_node *node, struct stat *buf)
+{
+  memset(buf, 0, sizeof(*buf));
+  buf->st_ino = node ? node - nodes + 1 : 0;
+  buf->st_nlink = 1;
+  if (node)
+    {
+      buf->st_mode = S_IFREG | 0666;
+      buf->st_size = node->size;
+      buf->st_mtim.tv_sec = node->mtime;
+      buf->st_blksize = RAMFS_BLOCK_SIZE;
+      buf->st_blocks = (node->size + 511) / 512;
+    }
+  else
+    buf->st_mode = S_IFDIR | 0777;
+}
+
+static int ramfs_fstat(struct _file *file, struct stat *buf)
+{
+  fill_stat(file->ram.node, buf);
+  return 0;
+}
+
+static off_t ramfs_lseek(struct _file *file, off_t offset, int whence)
+{
+  switch (whence)
+    {
+    case SEEK_SET:
+      break;
+    case SEEK_CUR:
+      offset += file->ram.pos;
+      break;
+    case SEEK_END:
+      offset += file->ram.node->size;
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+    }
+  if (offset < 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  file->ram.pos = offset;
+  return offset;
+}
+
+static ssize_t ramfs_read(struct _file *file, void *buf, size_t count)
+{
+  struct _ramfs_node *node = file->ram.node;
+  uint8_t *p = buf;
+  size_t total = 0;
+
+  if ((file->flags & O_ACCMODE) == O_WRONLY)
+    {
+      errno = EBADF;
+      return -1;
+    }
+  if (file->ram.pos >= node->size)
+    return 0;
+  if (count > node->size - file->ram.pos)
+    count = node->size - file->ram.pos;
+  while (count > 0)
+    {
+      uint32_t block = seek_block(file, file->ram.pos);
+      size_t ofs = file->ram.pos % RAMFS_BLOCK_SIZE;
+      size_t chunk = RAMFS_BLOCK_SIZE - ofs;
+      if (chunk > count)
+        chunk = count;
+      memcpy(p, blocks + block * RAMFS_BLOCK_SIZE + ofs, chunk);
+      p += chunk;
+      count -= chunk;
+      total += chunk;
+      file->ram.pos += chunk;
+    }
+  return total;
+}
+
+static ssize_t ramfs_write(struct _file *file, const void *buf, size_t count)
+{
+  struct _ramfs_node *node = file->ram.node;
+  const uint8_t *p = buf;
+  size_t total = 0;
+  off_t end;
+
+  if ((file->flags & O_ACCMODE) == O_RDONLY)
+    {
+      errno = EBADF;
+      return -1;
+    }
+  if (file->flags & O_APPEND)
+    file->ram.pos = node->size;
+  end = file->ram.pos + count;
+  if (end > UINT32_MAX)
+    {
+      errno = EFBIG;
+      return -1;
+    }
+  if (grow(node, end) < 0)
+    return -1;
+  if (file->ram.pos > node->size)
+    {
+      /* Zero the gap left by seeking past the end. */
+      off_t pos = node->size;
+      while (pos < file->ram.pos)
+        {
+          uint32_t block = seek_block(file, pos);
+          size_t ofs = pos % RAMFS_BLOCK_SIZE;
+          size_t chunk = RAMFS_BLOCK_SIZE - ofs;
+          if (chunk > (size_t)(file->ram.pos - pos))
+            chunk = file->ram.pos - pos;
+          memset(blocks + block * RAMFS_BLOCK_SIZE + ofs, 0, chunk);
+          pos += chunk;
+        }
+    }
+  while (count > 0)
+    {
+      uint32_t block = seek_block(file, file->ram.pos);
+      size_t ofs = file->ram.pos % RAMFS_BLOCK_SIZE;
+      size_t chunk = RAMFS_BLOCK_SIZE - ofs;
+      if (chunk > count)
+        chunk = count;
+      memcpy(blocks + block * RAMFS_BLOCK_SIZE + ofs, p, chunk);
+      p += chunk;
+      count -= chunk;
+      total += chunk;
+      file->ram.pos += chunk;
+    }
+  if (file->ram.pos > node->size)
+    node->size = file->ram.pos;
+  node->modified = true;
+  return total;
+}
+
+static struct _file_ops ramfs_ops = {
+    .close = ramfs_close,
+    .fstat = ramfs_fstat,
+    .lseek = ramfs_lseek,
+    .read = ramfs_read,
+    .write = ramfs_write,
+};
+
+static int ramfs_open(struct _file *file, const char *filename, int flags, mode_t mode)
+{
+  const char *name = ramfs_name(filename);
+  struct _ramfs_node *node;
+
+  if (!ramfs_ready())
+    return -1;
+  if (name == NULL)
+    {
+      errno = ENOENT;
+      return -1;
+    }
+  if (name[0] == '\0')
+    {
+      errno = EISDIR;
+      return -1;
+    }
+  node = find_node(name);
+  if (node != NULL && (flags & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))
+    {
+      errno = EEXIST;
+      return -1;
+    }
+  if (node == NULL)
+    {
+      if (!(flags & O_CREAT))
+        {
+          errno = ENOENT;
+          return -1;
+        }
+      if (strlen(name) > RAMFS_MAX_NAME)
+        {
+          errno = ENAMETOOLONG;
+          return -1;
+        }
+      for (node = nodes; node < nodes + RAMFS_MAX_FILES; node++)
+        if (node->name[0] == '\0')
+          break;
+      if (node == nodes + RAMFS_MAX_FILES)
+        {
+          errno = ENOSPC;
+          return -1;
+        }
+      strcpy(node->name, name);
+      node->first = RAMFS_NO_BLOCK;
+      node->mtime = time(NULL);
+    }
+  else if ((flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY)
+    {
+      free_chain(node->first);
+      node->first = RAMFS_NO_BLOCK;
+      node->size = 0;
+      node->modified = true;
+      node->truncs++;
+    }
+  node->opens++;
+  file->ram.node = node;
+  file->ram.pos = 0;
+  file->ram.block = RAMFS_NO_BLOCK;
+  file->ram.block_pos = 0;
+  file->ram.truncs = node->truncs;
+  file->ops = &ramfs_ops;
+  file->flags = flags;
+  return 0;
+}
+
+static int ramfs_access(const char *pathname, int mode)
+{
+  const char *name = ramfs_name(pathname);
+  if (!ramfs_ready())
+    return -1;
+  if (name == NULL || (name[0] != '\0' && find_node(name) == NULL))
+    {
+      errno = ENOENT;
+      return -1;
+    }
+  return 0;
+}
+
+static int ramfs_stat(const char *__restrict filename, struct stat *__restrict buf)
+{
+  const char *name = ramfs_name(filename);
+  struct _ramfs_node *node = NULL;
+  if (!ramfs_ready())
+    return -1;
+  if (name == NULL || (name[0] != '\0' && (node = find_node(name)) == NULL))
+    {
+      errno = ENOENT;
+      return -1;
+    }
+  fill_stat(node, buf);
+  return 0;
+}
+
+static int ramfs_unlink(const char *path)
+{
+  struct _ramfs_node *node = lookup(path);
+  if (node == NULL)
+    return -1;
+  if (node->opens > 0)
+    node->unlinked = true;
+  else
+    release_node(node);
+  return 0;
+}
+
+static int ramfs_rename(const char *oldpath, const char *newpath)
+{
+  struct _ramfs_node *node, *old;
+  const char *name;
+
+  node = lookup(oldpath);
+  if (node == NULL)
+    return -1;
+  name = ramfs_name(newpath);
+  if (name == NULL || name[0] == '\0')
+    {
+      errno = name ? EISDIR : ENOENT;
+      return -1;
+    }
+  if (strlen(name) > RAMFS_MAX_NAME)
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+  old = find_node(name);
+  if (old != NULL && old != node)
+    {
+      /* Replace the existing file, as rename() does. */
+      if (old->opens > 0)
+        old->unlinked = true;
+      else
+        release_node(old);
+    }
+  strcpy(node->name, name);
+  return 0;
+}
+
+static DIR *ramfs_opendir(const char *name)
+{
+  const char *dirname = ramfs_name(name);
+  struct ramfs_dir *dir;
+
+  if (!ramfs_ready())
+    return NULL;
+  if (dirname == NULL || dirname[0] != '\0')
+    {
+      errno = (dirname && find_node(dirname)) ? ENOTDIR : ENOENT;
+      return NULL;
+    }
+  dir = calloc(1, sizeof(*dir));
+  if (dir == NULL)
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+  return (DIR *)dir;
+}
+
+static void fat_datetime(time_t t, uint16_t *date, uint16_t *time)
+{
+  struct tm *tm = localtime(&t);
+  if (tm == NULL || tm->tm_year < 80)
+    {
+      *date = (1 << 5) | 1;     /* Jan 1, 1980 */
+      *time = 0;
+      return;
+    }
+  *date = (tm->tm_year - 80) << 9 | (tm->tm_mon + 1) << 5 | tm->tm_mday;
+  *time = tm->tm_hour << 11 | tm->tm_min << 5 | tm->tm_sec / 2;
+}
+
+/* The next file in the directory, or NULL at the end. */
+static struct _ramfs_node *next_node(struct ramfs_dir *dir)
+{
+  while (dir->index < RAMFS_MAX_FILES)
+    {
+      struct _ramfs_node *node = &nodes[dir->index++];
+      if (node->name[0] != '\0' && !node->unlinked)
+        return node;
+    }
+  return NULL;
+}
+
+static struct dirent *ramfs_readdir(DIR *dirp)
+{
+  struct ramfs_dir *dir = (struct ramfs_dir *)dirp;
+  struct _ramfs_node *node;
+  if (!dir->dotdot_done)
+    {
+      /* Like the SD volumes, the root has a way back up. */
+      dir->dotdot_done = true;
+      memset(&dir->dirent, 0, sizeof(dir->dirent));
+      strcpy(dir->dirent.d_name, "..");
+      dir->dirent.d_attrib = AM_DIR;
+      return &dir->dirent;
+    }
+  node = next_node(dir);
+  if (node == NULL)
+    return NULL;
+  memset(&dir->dirent, 0, sizeof(dir->dirent));
+  strcpy(dir->dirent.d_name, node->name);
+  dir->dirent.d_size = node->size;
+  fat_datetime(node->mtime, &dir->dirent.d_date, &dir->dirent.d_time);
+  return &dir->dirent;
+}
+
+static int ramfs_readdir_batch(DIR *dirp, struct _dirent_entry *entries, int max_entries,
+                         char *names, size_t names_size, const char *ext, int flags)
+{
+  struct ramfs_dir *dir = (struct ramfs_dir *)dirp;
+  int n = 0;
+
+  if (!dir->dotdot_done)
+    {
+      dir->dotdot_done = true;
+      if (!(flags & _READDIR_NO_DOTDOT) && max_entries > 0)
+        {
+          entries[n].d_name = "..";
+          entries[n].d_size = 0;
+          entries[n].d_date = 0;
+          entries[n].d_time = 0;
+          entries[n].d_attrib = AM_DIR;
+          n++;
+        }
+    }
+  while (n < max_entries)
+    {
+      int index = dir->index;
+      struct _ramfs_node *node = next_node(dir);
+      size_t len;
+      if (node == NULL)
+        break;
+      if (ext && !_match_ext(node->name, ext))
+        continue;
+      len = strlen(node->name) + 1;
+      if (len > names_size)
+        {
+          /* Leave the entry for the next call. */
+          dir->index = index;
+          if (n > 0)
+            break;
+          errno = EINVAL;
+          return -1;
+        }
+      memcpy(names, node->name, len);
+      entries[n].d_name = names;
+      entries[n].d_size = node->size;
+      fat_datetime(node->mtime, &entries[n].d_date, &entries[n].d_time);
+      entries[n].d_attrib = 0;
+      names += len;
+      names_size -= len;
+      n++;
+    }
+  _sort_dirent_entries(entries, n, flags);
+  return n;
+}
+
+static int ramfs_closedir(DIR *dirp)
+{
+  free(dirp);
+  return 0;
+}
+
+const struct _fs_ops _ramfs_fs_ops = {
+    .open = ramfs_open,
+    .access = ramfs_access,
+    .stat = ramfs_stat,
+    .unlink = ramfs_unlink,
+    .rename = ramfs_rename,
+    .opendir = ramfs_opendir,
+    .readdir = ramfs_readdir,
+    .readdir_batch = ramfs_readdir_batch,
+    .closedir = ramfs_closedir,
+};
+#endif
@@ -20,6 +20,7 @@ extern void __start(void);
 #ifndef ROM
 void __attribute__ ((noreturn)) _restart(void)
 {
+  _vblank_disable();
   _loader_data->reset_type = _RESET_TYPE_APP_RESTART;
   __asm__("move.l %0,%%sp\n"
           "move.l %1,%%a0\n"
@@ -15,6 +15,7 @@
  */
 
 #include <errno.h>
+#include <stddef.h>
 /*
  * sbrk -- changes heap size size. Get nbytes more
  *         RAM. We just increment a pointer in what's
@@ -28,20 +29,40 @@ extern void *__heap_limit;
 
 #define STACK_SIZE 8192
 
-void *
-sbrk (ptrdiff_t nbytes)
+static char *heap = __end;
+
+static char *
+heap_end (void)
 {
-  static char *heap = __end;
   char *end = __heap_limit;
-  char *base = heap;
-  char *new_heap = heap + nbytes;
-  
+
   if (!end)
     {
       /* Use sp - STACK_SIZE as the heap limit.  */
       __asm__ __volatile__ ("move.l %/sp,%0" : "=r"(end));
       end -= STACK_SIZE;
     }
+  return end;
+}
+
+/*
+ * _heap_free -- how many more bytes sbrk can hand out
+ */
+
+size_t
+_heap_free (void)
+{
+  char *end = heap_end ();
+  return end > heap ? (size_t)(end - heap) : 0;
+}
+
+void *
+sbrk (ptrdiff_t nbytes)
+{
+  char *end = heap_end ();
+  char *base = heap;
+  char *new_heap = heap + nbytes;
+
   if (nbytes < 0 || (long)(end - new_heap) < 0)
     {
       errno = ENOMEM;
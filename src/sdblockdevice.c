@@ -247,6 +247,7 @@ int _sd_read_internal(struct _sd_block_device *device, uint8_t *buffer, uint32_t
 int _sd_read_bytes(struct _sd_block_device *device, uint8_t *buffer, uint32_t length);
 uint8_t _sd_write(struct _sd_block_device *device, const uint8_t *buffer, uint8_t token, uint32_t length);
 int _sd_freq(struct _sd_block_device *device);
+uint32_t _sd_read_au_size(struct _sd_block_device *device);
 void _sd_preclock_then_select(struct _sd_block_device *device);
 void _sd_postclock_then_deselect(struct _sd_block_device *device);
 
@@ -367,6 +368,7 @@ void _sd_construct(struct _sd_block_device *this, int spi_index, uint64_t hz, bo
     this->_transfer_sck = hz;
 
     this->_erase_size = BLOCK_SIZE_HC;
+    this->_au_size = 0;
 }
 
 void _sd_destroy(struct _sd_block_device *this)
@@ -516,6 +518,10 @@ int _sd_init(struct _sd_block_device *this)
         return err;
     }
 
+    // ACMD13: the allocation unit size is optional, carry on without it
+    this->_au_size = _sd_read_au_size(this);
+    debug_if(SD_DBG, "AU size: %" PRIu32 "\n", this->_au_size);
+
 end:
     _sd_unlock(this);
     return SD_BLOCK_DEVICE_OK;
@@ -758,6 +764,16 @@ sd_size_t _sd_get_program_size(struct _sd_block_device *this)
     return _block_size;
 }
 
+sd_size_t _sd_get_au_size(struct _sd_block_device *this)
+{
+    return this->_au_size ? this->_au_size : this->_erase_size;
+}
+
+sd_size_t _sd_get_erase_size(struct _sd_block_device *this)
+{
+    return this->_erase_size;
+}
+
 sd_size_t _sd_size(struct _sd_block_device *this)
 {
     return _block_size * this->_sectors;
@@ -957,6 +973,7 @@ int _sd_cmd(struct _sd_block_device *this, enum cmdSupported cmd, uint32_t arg,
 
     // Do not deselect card if read is in progress.
     if (((CMD9_SEND_CSD == cmd) || (ACMD22_SEND_NUM_WR_BLOCKS == cmd) ||
+            (isAcmd && ACMD13_SD_STATUS == cmd) ||
             (CMD24_WRITE_BLOCK == cmd) || (CMD25_WRITE_MULTIPLE_BLOCK == cmd) ||
             (CMD17_READ_SINGLE_BLOCK == cmd) || (CMD18_READ_MULTIPLE_BLOCK == cmd))
             && (SD_BLOCK_DEVICE_OK == status)) {
@@ -1193,6 +1210,30 @@ sd_size_t _sd_sectors(struct _sd_block_device *this)
     return blocks;
 }
 
+uint32_t _sd_read_au_size(struct _sd_block_device *this)
+{
+    // AU_SIZE codes from the SD_STATUS register
+    static const uint32_t au_sizes[16] = {
+        0, 16UL << 10, 32UL << 10, 64UL << 10, 128UL << 10, 256UL << 10, 512UL << 10,
+        1UL << 20, 2UL << 20, 4UL << 20, 8UL << 20, 12UL << 20, 16UL << 20,
+        24UL << 20, 32UL << 20, 64UL << 20
+    };
+
+    // ACMD13, Response R2 (R1 byte + status byte) followed by 64-byte block read
+    if (_sd_cmd(this, ACMD13_SD_STATUS, 0x0, 1, NULL) != 0x0) {
+        debug_if(SD_DBG, "SD_STATUS not supported\n");
+        return 0;
+    }
+    uint8_t status[64];
+    if (_sd_read_bytes(this, status, 64) != 0) {
+        debug_if(SD_DBG, "Couldn't read SD_STATUS from disk\n");
+        return 0;
+    }
+
+    // au_size : status[431:428]
+    return au_sizes[status[10] >> 4];
+}
+
 // SPI function to wait till chip is ready and sends start token
 bool _sd_wait_token(struct _sd_block_device *this, uint8_t token)
 {
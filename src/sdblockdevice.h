@@ -74,6 +74,7 @@ struct _sd_block_device {
 
     //PlatformMutex _mutex;
     uint32_t _erase_size;
+    uint32_t _au_size;              /**< Allocation unit from SD_STATUS, 0 if unknown */
     bool _is_initialized;
     bool _dbg;
     uint32_t _init_ref_count;
@@ -176,6 +177,22 @@ sd_size_t _sd_get_read_size(struct _sd_block_device *device);
  */
 sd_size_t _sd_get_program_size(struct _sd_block_device *device);
 
+/** Get the size of the card's allocation unit (AU)
+ *
+ *  @return         Size of an allocation unit in bytes, or the erase size if
+ *                  the card does not report one
+ *  @note Files laid out on AU boundaries are written by the card one AU
+ *        after another, without reorganising partly used AUs
+ */
+sd_size_t _sd_get_au_size(struct _sd_block_device *device);
+
+/** Get the size of an erasable block
+ *
+ *  @return         Size of an erasable block in bytes; _sd_trim() takes
+ *                  whole blocks only
+ */
+sd_size_t _sd_get_erase_size(struct _sd_block_device *device);
+
 /** Get the total size of the underlying device
  *
  *  @return         Size of the underlying device in bytes
@@ -4,8 +4,6 @@
 #include "io.h"
 #include "nextp8.h"
 
-extern char *last_error;
-
 static int stdio_initialized;
 
 static int stdio_isatty(struct _file *file)
@@ -17,7 +15,11 @@ static ssize_t stdio_read (struct _file *file, void *buf, size_t count)
 {
   if (file->stdio == 0)
     {
+#ifdef ROM
       return 0;
+#else
+      return _uart_read(buf, count);
+#endif
     }
   else
     {
@@ -27,24 +29,59 @@ static ssize_t stdio_read (struct _file *file, void *buf, size_t count)
 }
 
 #ifndef ROM
-static void append_to_last_error(const void *buf, size_t count)
+/* The tail of stderr, for the crash screen shown by _exit(). The ring is
+   allocated once, by _init_stdio(), so a write to stderr only costs a copy.
+   An application can define _stderr_capture_size to change its size, or
+   set it to 0 to capture nothing. */
+const size_t __attribute__ ((weak)) _stderr_capture_size = 1024;
+
+static char *err_ring;
+static size_t err_size, err_pos;
+static int err_full;
+
+static void capture_stderr(const char *src, size_t count)
 {
-  size_t oldlen = (last_error != NULL) ? strlen(last_error) : 0;
-  char *new_last_error = realloc(last_error, oldlen + count + 1);
-  if (!new_last_error)
+  size_t n;
+  if (err_ring == NULL || count == 0)
     return;
-  last_error = new_last_error;
-  char last = (oldlen > 0) ? last_error[oldlen - 1] : '\n';
-  const char *src = buf;
-  char *dst = last_error + oldlen;
-  for (int i=0;i<count;++i) {
-    char c = *src++;
-    if (last == '\n')
-       dst = last_error;
-    *dst++ = c;
-    last = c;
-  }
-  *dst++ = '\0';
+  if (count >= err_size)
+    {
+      src += count - err_size;
+      count = err_size;
+    }
+  n = err_size - err_pos;
+  if (n > count)
+    n = count;
+  memcpy(err_ring + err_pos, src, n);
+  memcpy(err_ring, src + n, count - n);
+  if (err_pos + count >= err_size)
+    err_full = 1;
+  err_pos = (err_pos + count) % err_size;
+}
+
+/* Copy the last lines lines written to stderr (0: all that were kept) to
+   buf, without the final newline, and return their length. */
+size_t _stderr_tail(char *buf, size_t size, unsigned lines)
+{
+  size_t len = err_full ? err_size : err_pos;
+  size_t base = err_full ? err_pos : 0;
+  size_t start, end, i;
+#define AT(i) err_ring[(base + (i)) % err_size]
+  if (size == 0)
+    return 0;
+  end = len;
+  while (end > 0 && AT(end - 1) == '\n')
+    end--;
+  start = end;
+  while (start > 0 && (AT(start - 1) != '\n' || --lines > 0))
+    start--;
+  if (end - start > size - 1)
+    start = end - (size - 1);
+  for (i = start; i < end; i++)
+    buf[i - start] = AT(i);
+#undef AT
+  buf[end - start] = '\0';
+  return end - start;
 }
 #endif
 
@@ -59,7 +96,8 @@ static ssize_t stdio_write(struct _file *file, const void *buf, size_t count)
     {
 #ifndef ROM
       if (file->stdio == 2)
-        append_to_last_error(buf, count);
+        capture_stderr(buf, count);
+      _console_write(buf, count);
 #endif
 
       _uart_write(buf, count);
@@ -78,10 +116,21 @@ void _init_stdio(void)
   if (stdio_initialized)
     return;
   stdio_initialized = 1;
-  _files[0].ops = &stdio_ops;
-  _files[0].stdio = 0;
-  _files[1].ops = &stdio_ops;
-  _files[1].stdio = 1;
-  _files[2].ops = &stdio_ops;
-  _files[2].stdio = 2;
+  for (int i=0;i<3;++i)
+    {
+      struct _file *file;
+      int fd = _alloc_file(&file);
+      if (fd < 0)
+        break;
+      file->ops = &stdio_ops;
+      file->stdio = fd;
+    }
+#ifndef ROM
+  if (_stderr_capture_size > 0)
+    {
+      err_ring = malloc(_stderr_capture_size);
+      if (err_ring != NULL)
+        err_size = _stderr_capture_size;
+    }
+#endif
 }
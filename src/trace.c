@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* Binary trace.
+ *
+ * _TRACE(fmt, ...) in nextp8.h puts its format string in the .trace_fmt
+ * section, which the linker script keeps out of memory, and records only
+ * the string's offset in that section, a timestamp and the arguments.
+ * Nothing is formatted on the board: tools/p8trace.c looks the formats up
+ * in the ELF file and rebuilds the text on the host.
+ *
+ * A record is a sequence of 32-bit words in a RAM ring:
+ *
+ *   nargs << 24 | format offset
+ *   low 32 bits of _UTIMER_1MHZ
+ *   nargs argument words
+ *
+ * If the ring is full the record is dropped, and the next record that fits
+ * is preceded by a TRACE_ID_DROPPED record giving the number lost.
+ *
+ * _trace_poll() moves whole records to the sink chosen with
+ * _trace_to_uart() or _trace_to_file(), as far as that can be done without
+ * waiting. It runs from _idle(), and may also be called from a vblank
+ * handler, although a file is only written outside interrupt handlers.
+ * On the UART each batch of records is sent as a SLIP frame, so
+ * the decoder can tell it apart from ordinary text. A file starts with
+ * "P8TR" and the version, followed by the bare records, and is written
+ * through the log writer. _exit() and _fatal_error() drain the ring with
+ * _trace_flush(). */
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "io.h"
+#include "mmio.h"
+#include "nextp8.h"
+
+#ifndef ROM
+#define TRACE_WORDS 2048                /* a power of two */
+#define TRACE_ID_DROPPED 0xFFFFFFu
+#define TRACE_VERSION 1
+#define TRACE_FRAME_SIZE 256
+
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+enum { SINK_NONE, SINK_UART, SINK_FILE };
+
+static uint32_t ring[TRACE_WORDS];
+static volatile unsigned head, tail;    /* in words */
+static unsigned dropped;
+static int sink = SINK_NONE;
+static int sink_log = -1;
+static volatile int busy;
+
+static inline int in_interrupt(void)
+{
+  return _interrupt_depth != 0;
+}
+
+void _trace_emit(uint32_t id, unsigned nargs, const uint32_t *args)
+{
+  uint32_t now = MMIO_REG32(_UTIMER_1MHZ_3116);
+  unsigned short sr = _irq_disable();
+  unsigned h = head, need = 2 + nargs + (dropped ? 3 : 0);
+  if (TRACE_WORDS - (h - tail) < need)
+    {
+      dropped++;
+      _irq_restore(sr);
+      return;
+    }
+  if (dropped)
+    {
+      ring[h++ % TRACE_WORDS] = TRACE_ID_DROPPED | (1u << 24);
+      ring[h++ % TRACE_WORDS] = now;
+      ring[h++ % TRACE_WORDS] = dropped;
+      dropped = 0;
+    }
+  ring[h++ % TRACE_WORDS] = id | ((uint32_t)nargs << 24);
+  ring[h++ % TRACE_WORDS] = now;
+  while (nargs-- > 0)
+    ring[h++ % TRACE_WORDS] = *args++;
+  head = h;
+  _irq_restore(sr);
+}
+
+/* Length in words of the record starting at word t. */
+static unsigned record_words(unsigned t)
+{
+  return 2 + (ring[t % TRACE_WORDS] >> 24);
+}
+
+static size_t put_escaped(uint8_t *out, uint32_t word)
+{
+  size_t n = 0;
+  int shift;
+  for (shift = 24; shift >= 0; shift -= 8)
+    {
+      uint8_t b = word >> shift;
+      if (b == SLIP_END)
+        {
+          out[n++] = SLIP_ESC;
+          out[n++] = SLIP_ESC_END;
+        }
+      else if (b == SLIP_ESC)
+        {
+          out[n++] = SLIP_ESC;
+          out[n++] = SLIP_ESC_ESC;
+        }
+      else
+        out[n++] = b;
+    }
+  return n;
+}
+
+static void poll_uart(void)
+{
+  uint8_t frame[TRACE_FRAME_SIZE];
+  unsigned t = tail;
+  while (t != head)
+    {
+      size_t len = 0, room = _uart_tx_free();
+      if (room > sizeof(frame))
+        room = sizeof(frame);
+      frame[len++] = SLIP_END;
+      /* Whole records only, each at worst twice its size once escaped. */
+      while (t != head && len + record_words(t) * 8 + 1 <= room)
+        {
+          unsigned i, n = record_words(t);
+          for (i = 0; i < n; i++)
+            len += put_escaped(frame + len, ring[(t + i) % TRACE_WORDS]);
+          t += n;
+        }
+      if (len == 1)
+        break;
+      frame[len++] = SLIP_END;
+      _uart_write((const char *)frame, len);
+      tail = t;
+    }
+}
+
+static void poll_file(void)
+{
+  uint32_t buf[64];
+  unsigned t = tail;
+  while (t != head)
+    {
+      size_t n = 0;
+      while (t != head && n + record_words(t) <= sizeof(buf) / sizeof(buf[0]))
+        {
+          unsigned i, words = record_words(t);
+          for (i = 0; i < words; i++)
+            buf[n++] = ring[(t + i) % TRACE_WORDS];
+          t += words;
+        }
+      if (_log_write(sink_log, buf, n * sizeof(buf[0])) < 0)
+        break;
+      tail = t;
+    }
+}
+
+/* Record the drops now rather than waiting for the next event. */
+static void record_dropped(void)
+{
+  unsigned short sr = _irq_disable();
+  unsigned h = head;
+  if (dropped && TRACE_WORDS - (h - tail) >= 3)
+    {
+      ring[h++ % TRACE_WORDS] = TRACE_ID_DROPPED | (1u << 24);
+      ring[h++ % TRACE_WORDS] = MMIO_REG32(_UTIMER_1MHZ_3116);
+      ring[h++ % TRACE_WORDS] = dropped;
+      dropped = 0;
+      head = h;
+    }
+  _irq_restore(sr);
+}
+
+static void poll_sink(void)
+{
+  if (sink == SINK_UART)
+    poll_uart();
+  else if (sink == SINK_FILE && !in_interrupt())
+    poll_file();
+}
+
+void _trace_poll(void)
+{
+  /* An interrupt handler may poll while the main program is polling. */
+  if (busy)
+    return;
+  busy = 1;
+  poll_sink();
+  if (dropped)
+    {
+      record_dropped();
+      poll_sink();
+    }
+  busy = 0;
+}
+
+void _trace_flush(void)
+{
+  /* As in _uart_flush(), we may have interrupted _trace_poll(). */
+  busy = 0;
+  if (sink == SINK_UART)
+    {
+      while (tail != head)
+        {
+          _trace_poll();
+          _uart_flush();
+        }
+    }
+  else if (sink == SINK_FILE)
+    {
+      _trace_poll();
+      _log_flush(sink_log);
+    }
+}
+
+static void close_sink(void)
+{
+  _trace_flush();
+  if (sink == SINK_FILE)
+    _log_close(sink_log);
+  sink = SINK_NONE;
+  sink_log = -1;
+}
+
+int _trace_to_uart(void)
+{
+  close_sink();
+  sink = SINK_UART;
+  return 0;
+}
+
+int _trace_to_file(const char *path)
+{
+  static const char header[8] = { 'P', '8', 'T', 'R', 0, 0, 0, TRACE_VERSION };
+  int log;
+  close_sink();
+  unlink(path);
+  log = _log_open(path, 0, 1000);
+  if (log < 0)
+    return -1;
+  if (_log_write(log, header, sizeof(header)) < 0)
+    {
+      _log_close(log);
+      return -1;
+    }
+  sink_log = log;
+  sink = SINK_FILE;
+  return 0;
+}
+#endif
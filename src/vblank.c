@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* Page flips and the vblank interrupt.
+ *
+ * _flip_async() asks for the buffers to be swapped at the next vblank and
+ * returns at once, so the next frame's logic can run while the current one
+ * waits to be shown. The back buffer is still on screen until the swap, so
+ * call _flip_wait() before drawing into it. _flip() is the two together.
+ *
+ * _vblank_enable() installs a handler for the vblank interrupt, which
+ * counts vblanks and flips and calls the functions added with
+ * _vblank_add(). The callbacks run in the interrupt, so they should be
+ * short; _uart_poll() and _trace_poll() are suitable. A frame that stays
+ * on screen for more than one vblank because the next was not ready is
+ * counted as missed, once for each extra vblank. */
+
+#include <errno.h>
+#include <stdint.h>
+#include "io.h"
+#include "mmio.h"
+#include "nextp8.h"
+
+#ifndef ROM
+#define VBLANK_CALLBACKS 4
+#define AUTOVECTOR_BASE 24
+
+extern const int __interrupt_vector[];
+
+volatile int _interrupt_depth;
+
+static struct {
+  void (*fn)(void *);
+  void *arg;
+} callbacks[VBLANK_CALLBACKS];
+static volatile int vblank_on;
+static volatile int flip_requested;
+static int flip_target;
+static volatile uint32_t vblanks, flips, missed;
+static uint32_t last_flip_vblank;
+
+/* The requested buffer went on screen at vblank number now: count the
+   flip. Without the handler vblanks does not move, so nothing is counted.
+   Called with the vblank interrupt masked, or from the handler. */
+static void flip_done(uint32_t now)
+{
+  if (vblank_on)
+    {
+      if (flips++ > 0 && now > last_flip_vblank)
+        missed += now - last_flip_vblank - 1;
+      last_flip_vblank = now;
+    }
+  flip_requested = 0;
+}
+
+static void __attribute__ ((interrupt_handler)) vblank_interrupt(void)
+{
+  int i;
+  _interrupt_depth++;
+  /* Acknowledge. */
+  MMIO_REG8(_VBLANK_INTR_CTRL) = _VBLANK_INTR_ENABLE;
+  vblanks++;
+  if (flip_requested && MMIO_REG8(_VFRONT) == flip_target)
+    flip_done(vblanks);
+  for (i = 0; i < VBLANK_CALLBACKS; i++)
+    if (callbacks[i].fn != NULL)
+      callbacks[i].fn(callbacks[i].arg);
+  _interrupt_depth--;
+}
+
+/* Whether the vblank handler would run at once in a context with status
+   register sr, rather than after we return. */
+static int handler_can_run(unsigned short sr)
+{
+  return vblank_on && _interrupt_depth == 0
+         && ((sr >> 8) & 7) < _VBLANK_IRQ_LEVEL;
+}
+
+void _flip_wait(void)
+{
+  unsigned short sr;
+  while (flip_requested && MMIO_REG8(_VFRONT) != flip_target)
+    ;
+  /* The buffer is on screen, so return now rather than waiting for the
+     handler to notice. If the flip is still uncounted, the handler that
+     would have counted it has not run yet for the vblank at which it
+     happened, if it can run at all. */
+  sr = _irq_disable();
+  if (flip_requested)
+    flip_done(vblanks + handler_can_run(sr));
+  _irq_restore(sr);
+}
+
+void _flip_async(void)
+{
+  /* Only one flip can be outstanding. */
+  _flip_wait();
+  flip_target = 1 - MMIO_REG8(_VFRONT);
+  flip_requested = 1;
+  MMIO_REG8(_VFRONTREQ) = flip_target;
+}
+
+int _flip_pending(void)
+{
+  return flip_requested && MMIO_REG8(_VFRONT) != flip_target;
+}
+
+void _vblank_enable(void)
+{
+  unsigned short sr, level;
+  if (vblank_on)
+    return;
+  sr = _irq_disable();
+  ((void (**)(void))__interrupt_vector)[AUTOVECTOR_BASE + _VBLANK_IRQ_LEVEL]
+    = vblank_interrupt;
+  vblanks = flips = missed = 0;
+  vblank_on = 1;
+  MMIO_REG8(_VBLANK_INTR_CTRL) = _VBLANK_INTR_ENABLE;
+  /* Let the vblank in, if the mask was keeping it out. */
+  level = (sr >> 8) & 7;
+  if (level >= _VBLANK_IRQ_LEVEL)
+    level = _VBLANK_IRQ_LEVEL - 1;
+  _irq_restore((sr & ~0x0700) | (level << 8));
+}
+
+void _vblank_disable(void)
+{
+  unsigned short sr = _irq_disable();
+  MMIO_REG8(_VBLANK_INTR_CTRL) = 0;
+  vblank_on = 0;
+  _irq_restore(sr);
+}
+
+/* Call fn(arg) from the vblank interrupt, enabling it if need be. */
+int _vblank_add(void (*fn)(void *), void *arg)
+{
+  unsigned short sr;
+  int i;
+  for (i = 0; i < VBLANK_CALLBACKS; i++)
+    if (callbacks[i].fn == NULL)
+      break;
+  if (i == VBLANK_CALLBACKS)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+  sr = _irq_disable();
+  callbacks[i].arg = arg;
+  callbacks[i].fn = fn;
+  _irq_restore(sr);
+  _vblank_enable();
+  return 0;
+}
+
+int _vblank_remove(void (*fn)(void *), void *arg)
+{
+  unsigned short sr;
+  int i;
+  for (i = 0; i < VBLANK_CALLBACKS; i++)
+    if (callbacks[i].fn == fn && callbacks[i].arg == arg)
+      {
+        sr = _irq_disable();
+        callbacks[i].fn = NULL;
+        _irq_restore(sr);
+        return 0;
+      }
+  errno = ENOENT;
+  return -1;
+}
+
+void _frame_stats(struct _frame_stats *stats)
+{
+  unsigned short sr = _irq_disable();
+  stats->vblanks = vblanks;
+  stats->flips = flips;
+  stats->missed = missed;
+  _irq_restore(sr);
+}
+#endif
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* Mount table.
+ *
+ * The path-based system calls look up the file system for a path here and
+ * call through its struct _fs_ops. The entry with the longest matching
+ * prefix wins, and the backend sees the path with that prefix removed.
+ * FatFs is mounted at "", so it gets every path nothing else claims,
+ * unchanged. Directories are wrapped in a struct _vfs_dir so readdir() and
+ * closedir() can find their way back to the right backend. */
+
+#include <sys/types.h>
+#define DIR DIRENT_DIR
+#include <dirent.h>
+#undef DIR
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "io.h"
+
+#ifdef ROM
+#define VFS_MAX_MOUNTS 1
+#else
+#define VFS_MAX_MOUNTS 8
+#endif
+
+struct mount {
+  const char *prefix;
+  size_t len;
+  const struct _fs_ops *ops;
+};
+
+struct _vfs_dir {
+  const struct _fs_ops *ops;
+  DIR *dir;             /* the backend's own directory object */
+};
+
+static struct mount mounts[VFS_MAX_MOUNTS] = {
+#ifndef ROM
+  { "ram:", 4, &_ramfs_fs_ops },
+#endif
+  { "", 0, &_fatfs_fs_ops },
+};
+
+const struct _fs_ops *_vfs_lookup(const char **path)
+{
+  struct mount *m, *best = NULL;
+  for (m = mounts; m < mounts + VFS_MAX_MOUNTS; m++)
+    {
+      if (m->ops != NULL && (best == NULL || m->len > best->len)
+          && strncasecmp(*path, m->prefix, m->len) == 0)
+        best = m;
+    }
+  if (best == NULL)
+    {
+      errno = ENOENT;
+      return NULL;
+    }
+  *path += best->len;
+  if (best->ops->init != NULL)
+    best->ops->init();
+  return best->ops;
+}
+
+#ifndef ROM
+int _vfs_mount(const char *prefix, const struct _fs_ops *ops)
+{
+  struct mount *m, *unused = NULL;
+  for (m = mounts; m < mounts + VFS_MAX_MOUNTS; m++)
+    {
+      if (m->ops != NULL && strcasecmp(m->prefix, prefix) == 0)
+        {
+          errno = EBUSY;
+          return -1;
+        }
+      if (m->ops == NULL && unused == NULL)
+        unused = m;
+    }
+  if (unused == NULL)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+  unused->prefix = prefix;
+  unused->len = strlen(prefix);
+  unused->ops = ops;
+  return 0;
+}
+
+int _vfs_unmount(const char *prefix)
+{
+  struct mount *m;
+  for (m = mounts; m < mounts + VFS_MAX_MOUNTS; m++)
+    {
+      if (m->ops != NULL && strcasecmp(m->prefix, prefix) == 0)
+        {
+          m->ops = NULL;
+          return 0;
+        }
+    }
+  errno = EINVAL;
+  return -1;
+}
+#endif
+
+DIR *_vfs_opendir(const char *name)
+{
+#ifdef ROM
+  errno = ENOSYS;
+  return NULL;
+#else
+  const struct _fs_ops *ops = _vfs_lookup(&name);
+  struct _vfs_dir *vdir;
+  DIR *dir;
+  if (ops == NULL)
+    return NULL;
+  if (ops->opendir == NULL)
+    {
+      errno = ENOTDIR;
+      return NULL;
+    }
+  dir = ops->opendir(name);
+  if (dir == NULL)
+    return NULL;
+  vdir = malloc(sizeof(*vdir));
+  if (vdir == NULL)
+    {
+      ops->closedir(dir);
+      errno = ENOMEM;
+      return NULL;
+    }
+  vdir->ops = ops;
+  vdir->dir = dir;
+  return (DIR *)vdir;
+#endif
+}
+
+struct dirent *_vfs_readdir(DIR *dirp)
+{
+  struct _vfs_dir *vdir = (struct _vfs_dir *)dirp;
+  return vdir->ops->readdir(vdir->dir);
+}
+
+int _vfs_readdir_batch(DIR *dirp, struct _dirent_entry *entries, int max_entries,
+                       char *names, size_t names_size, const char *ext, int flags)
+{
+  struct _vfs_dir *vdir = (struct _vfs_dir *)dirp;
+  if (vdir->ops->readdir_batch == NULL)
+    {
+      errno = ENOSYS;
+      return -1;
+    }
+  return vdir->ops->readdir_batch(vdir->dir, entries, max_entries, names, names_size,
+                                  ext, flags);
+}
+
+int _vfs_closedir(DIR *dirp)
+{
+#ifdef ROM
+  errno = ENOSYS;
+  return -1;
+#else
+  struct _vfs_dir *vdir = (struct _vfs_dir *)dirp;
+  int ret = vdir->ops->closedir(vdir->dir);
+  free(vdir);
+  return ret;
+#endif
+}
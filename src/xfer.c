@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* File transfer over the UART, receiving end. The sender is tools/p8send.c.
+ *
+ * Frames are SLIP encoded and end with the CRC-32 of their contents, so a
+ * damaged frame is simply dropped. The first byte gives the type:
+ *
+ *   O size name          sender: start a file of size bytes
+ *   o status window      receiver: 0 or an errno, and the window in blocks
+ *   D block data         sender: a 512 byte block (the last may be short)
+ *   A base bitmap token  receiver: blocks before base are written; bit i
+ *                        of bitmap is set if block base + i has arrived
+ *   P token              sender: asks for an A echoing token
+ *   E                    sender: all blocks sent
+ *   e status             receiver: the file is complete, or the transfer
+ *                        failed with that errno
+ *
+ * All numbers are 32-bit little-endian, except the 16-bit window.
+ *
+ * The sender streams a whole window of blocks without waiting. When every
+ * block of the window has arrived, the receiver writes the window to the
+ * file with one write(), which becomes a multi-block write into the
+ * preallocated, contiguous file. The area starts on an allocation unit
+ * boundary and AUs are 16 KB or a larger power of two, so the windows tile
+ * them. The receiver then sends an unsolicited A with token 0, and the
+ * sender moves on to the next window. If no A comes, the sender polls. The
+ * A that answers the poll lists the blocks that arrived, and only the
+ * missing ones are sent again. The UART is polled and holds almost
+ * nothing, so bytes arriving while the card is busy would be lost. The
+ * sender therefore stays quiet between a full window and its A. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mmio.h"
+#include "nextp8.h"
+
+#ifndef ROM
+#define XFER_BLOCK 512
+#define XFER_WINDOW 32          /* blocks; at most 32, the bits in an A */
+#define XFER_MAX_FRAME (1 + 4 + XFER_BLOCK + 4)
+#define XFER_MAX_SHORT (1 + 12)  /* longest frame we send, an A, less CRC */
+#define XFER_IDLE_MS 10000      /* give up on a silent sender */
+
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+static int last_done;           /* the last transfer completed */
+
+static uint32_t get_le32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+/* Send a short frame of at most XFER_MAX_SHORT bytes; frame must have room
+   for the CRC. */
+static void send_frame(uint8_t *frame, size_t len)
+{
+  /* Every byte escaped, between two ENDs. */
+  char out[2 * (XFER_MAX_SHORT + 4) + 2];
+  size_t i, n = 0;
+  put_le32(frame + len, _crc32(0, frame, len));
+  len += 4;
+  out[n++] = SLIP_END;
+  for (i = 0; i < len; i++)
+    {
+      if (frame[i] == SLIP_END)
+        {
+          out[n++] = SLIP_ESC;
+          out[n++] = SLIP_ESC_END;
+        }
+      else if (frame[i] == SLIP_ESC)
+        {
+          out[n++] = SLIP_ESC;
+          out[n++] = SLIP_ESC_ESC;
+        }
+      else
+        out[n++] = frame[i];
+    }
+  out[n++] = SLIP_END;
+  _uart_write(out, n);
+}
+
+static void send_status(int type, int status)
+{
+  uint8_t frame[1 + 4 + 2 + 4];
+  frame[0] = type;
+  put_le32(frame + 1, status);
+  if (type == 'o')
+    {
+      frame[5] = XFER_WINDOW & 0xff;
+      frame[6] = XFER_WINDOW >> 8;
+      send_frame(frame, 7);
+    }
+  else
+    send_frame(frame, 5);
+}
+
+static void send_ack(uint32_t base, uint32_t bitmap, uint32_t token)
+{
+  uint8_t frame[XFER_MAX_SHORT + 4];
+  frame[0] = 'A';
+  put_le32(frame + 1, base);
+  put_le32(frame + 5, bitmap);
+  put_le32(frame + 9, token);
+  send_frame(frame, XFER_MAX_SHORT);
+}
+
+/* Read the next intact frame into buf and return its length without the
+   CRC, or return -1 if none arrives by deadline (0: wait for ever). */
+static int recv_frame(uint8_t *buf, size_t size, uint64_t deadline)
+{
+  size_t len = 0;
+  int esc = 0, overflow = 0, c;
+  for (;;)
+    {
+      c = _uart_getc();
+      if (c < 0)
+        {
+          if (deadline != 0 && MMIO_REG64(_UTIMER_1MHZ) >= deadline)
+            return -1;
+          continue;
+        }
+      if (c == SLIP_END)
+        {
+          if (len > 4 && !overflow
+              && _crc32(0, buf, len - 4) == get_le32(buf + len - 4))
+            return len - 4;
+          len = 0;
+          esc = overflow = 0;
+          continue;
+        }
+      if (c == SLIP_ESC)
+        {
+          esc = 1;
+          continue;
+        }
+      if (esc)
+        {
+          if (c == SLIP_ESC_END)
+            c = SLIP_END;
+          else if (c == SLIP_ESC_ESC)
+            c = SLIP_ESC;
+          esc = 0;
+        }
+      if (len < size)
+        buf[len++] = c;
+      else
+        overflow = 1;
+    }
+}
+
+static uint64_t deadline_ms(unsigned ms)
+{
+  return MMIO_REG64(_UTIMER_1MHZ) + (uint64_t)ms * 1000;
+}
+
+/* Wait for a sender and receive one file into the path it names, which is
+   copied to path. Gives up if no transfer starts within timeout_ms (0: wait
+   for ever). */
+int _xfer_receive(char *path, size_t path_size, unsigned timeout_ms)
+{
+  uint8_t frame[XFER_MAX_FRAME];
+  uint8_t *window;
+  uint32_t size, nblocks, base = 0, bitmap = 0;
+  size_t name_len;
+  int n, fd, err;
+
+  for (;;)
+    {
+      n = recv_frame(frame, sizeof(frame), timeout_ms ? deadline_ms(timeout_ms) : 0);
+      if (n < 0)
+        {
+          errno = ETIMEDOUT;
+          return -1;
+        }
+      if (frame[0] == 'O' && n > 5)
+        break;
+      /* The sender missed our reply to the end of the last file. */
+      if (frame[0] == 'E' && last_done)
+        send_status('e', 0);
+    }
+  last_done = 0;
+  size = get_le32(frame + 1);
+  name_len = n - 5;
+  if (name_len >= path_size)
+    {
+      send_status('o', ENAMETOOLONG);
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+  memcpy(path, frame + 5, name_len);
+  path[name_len] = '\0';
+  window = malloc(XFER_WINDOW * XFER_BLOCK);
+  if (window == NULL)
+    {
+      send_status('o', ENOMEM);
+      errno = ENOMEM;
+      return -1;
+    }
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+    {
+      err = errno;
+      free(window);
+      send_status('o', err);
+      errno = err;
+      return -1;
+    }
+  /* Best effort: only FatFs files can be preallocated. */
+  if (size > 0)
+    _fatfs_preallocate(fd, size);
+  send_status('o', 0);
+
+  /* size + XFER_BLOCK - 1 would wrap for the largest files. */
+  nblocks = size / XFER_BLOCK + (size % XFER_BLOCK != 0);
+  for (;;)
+    {
+      n = recv_frame(frame, sizeof(frame), deadline_ms(XFER_IDLE_MS));
+      if (n < 0)
+        {
+          err = ETIMEDOUT;
+          goto fail;
+        }
+      switch (frame[0])
+        {
+        case 'O':
+          /* Our reply was lost. */
+          if (base == 0 && bitmap == 0)
+            send_status('o', 0);
+          break;
+        case 'D':
+          if (n >= 5)
+            {
+              uint32_t block = get_le32(frame + 1), count, full;
+              uint32_t i = block - base;
+              size_t len = n - 5;
+              if (block >= base && i < XFER_WINDOW && block < nblocks
+                  && len == (block + 1 < nblocks ? XFER_BLOCK
+                             : size - block * XFER_BLOCK))
+                {
+                  memcpy(window + i * XFER_BLOCK, frame + 5, len);
+                  bitmap |= (uint32_t)1 << i;
+                }
+              count = nblocks - base < XFER_WINDOW ? nblocks - base : XFER_WINDOW;
+              full = count == 32 ? 0xFFFFFFFFu : ((uint32_t)1 << count) - 1;
+              if (count > 0 && bitmap == full)
+                {
+                  size_t bytes = (base + count < nblocks ? count * XFER_BLOCK
+                                  : size - base * XFER_BLOCK);
+                  ssize_t written = write(fd, window, bytes);
+                  if (written != (ssize_t)bytes)
+                    {
+                      err = written < 0 ? errno : ENOSPC;
+                      goto fail;
+                    }
+                  base += count;
+                  bitmap = 0;
+                  send_ack(base, 0, 0);
+                }
+            }
+          break;
+        case 'P':
+          if (n >= 5)
+            send_ack(base, bitmap, get_le32(frame + 1));
+          break;
+        case 'E':
+          if (base == nblocks)
+            {
+              free(window);
+              if (close(fd) != 0)
+                {
+                  err = errno;
+                  send_status('e', err);
+                  errno = err;
+                  return -1;
+                }
+              last_done = 1;
+              send_status('e', 0);
+              _uart_flush();
+              return 0;
+            }
+          send_ack(base, bitmap, 0);
+          break;
+        }
+    }
+
+fail:
+  send_status('e', err);
+  close(fd);
+  free(window);
+  errno = err;
+  return -1;
+}
+#endif
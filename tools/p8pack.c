@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* Host tool: pack a directory tree into an archive read by src/pack.c.
+ *
+ *   cc -O2 -o p8pack tools/p8pack.c
+ *   p8pack [-z] output.pak directory
+ *
+ * With -z, members that LZ4 makes smaller are stored as .p8z streams. */
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include "p8z.h"
+
+#define SECTOR_SIZE 512
+#define BLOCK_SIZE 16384
+
+struct member {
+  char *name;           /* relative to the packed directory, '/' separated */
+  char *path;           /* host path */
+};
+
+static struct member *members;
+static size_t nmembers, members_cap;
+
+static void add_tree(const char *path, const char *name)
+{
+  DIR *dir = opendir(path);
+  struct dirent *ent;
+  if (dir == NULL)
+    {
+      perror(path);
+      exit(1);
+    }
+  while ((ent = readdir(dir)) != NULL)
+    {
+      char *child_path, *child_name;
+      struct stat st;
+      if (ent->d_name[0] == '.')
+        continue;
+      child_path = malloc(strlen(path) + strlen(ent->d_name) + 2);
+      child_name = malloc(strlen(name) + strlen(ent->d_name) + 2);
+      sprintf(child_path, "%s/%s", path, ent->d_name);
+      sprintf(child_name, "%s%s%s", name, *name ? "/" : "", ent->d_name);
+      if (stat(child_path, &st) != 0)
+        {
+          perror(child_path);
+          exit(1);
+        }
+      if (S_ISDIR(st.st_mode))
+        {
+          add_tree(child_path, child_name);
+          free(child_path);
+          free(child_name);
+          continue;
+        }
+      if (nmembers == members_cap)
+        {
+          members_cap = members_cap ? members_cap * 2 : 64;
+          members = realloc(members, members_cap * sizeof(*members));
+        }
+      members[nmembers].name = child_name;
+      members[nmembers].path = child_path;
+      nmembers++;
+    }
+  closedir(dir);
+}
+
+/* The BSP looks names up with strcasecmp, so sort the same way. */
+static int compare_members(const void *a, const void *b)
+{
+  return strcasecmp(((const struct member *)a)->name, ((const struct member *)b)->name);
+}
+
+static uint8_t *read_file(const char *path, size_t *size)
+{
+  FILE *f = fopen(path, "rb");
+  uint8_t *data;
+  long len;
+  if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0)
+    {
+      perror(path);
+      exit(1);
+    }
+  rewind(f);
+  data = malloc(len ? len : 1);
+  if (data == NULL || fread(data, 1, len, f) != (size_t)len)
+    {
+      perror(path);
+      exit(1);
+    }
+  fclose(f);
+  *size = len;
+  return data;
+}
+
+int main(int argc, char **argv)
+{
+  int compress = 0, argi = 1;
+  size_t i, names_size = 0, header, pos;
+  uint8_t *toc;
+  FILE *out;
+
+  if (argc == 4 && strcmp(argv[1], "-z") == 0)
+    {
+      compress = 1;
+      argi = 2;
+    }
+  if (argc - argi != 2)
+    {
+      fprintf(stderr, "usage: %s [-z] output.pak directory\n", argv[0]);
+      return 1;
+    }
+  add_tree(argv[argi + 1], "");
+  qsort(members, nmembers, sizeof(*members), compare_members);
+  for (i = 0; i + 1 < nmembers; i++)
+    if (strcasecmp(members[i].name, members[i + 1].name) == 0)
+      {
+        fprintf(stderr, "%s and %s differ only in case\n", members[i].name,
+                members[i + 1].name);
+        return 1;
+      }
+
+  for (i = 0; i < nmembers; i++)
+    names_size += strlen(members[i].name) + 1;
+  header = 16 + nmembers * 20 + names_size;
+  toc = calloc(1, header);
+  memcpy(toc, "P8PK", 4);
+  put_le32(toc + 4, 1);
+  put_le32(toc + 8, nmembers);
+  put_le32(toc + 12, names_size);
+
+  out = fopen(argv[argi], "wb");
+  if (out == NULL || fwrite(toc, 1, header, out) != header)
+    {
+      perror(argv[argi]);
+      return 1;
+    }
+  pos = header;
+  size_t name_pos = 0, total_in = 0;
+  for (i = 0; i < nmembers; i++)
+    {
+      uint8_t *entry = toc + 16 + i * 20;
+      size_t size, stored;
+      uint8_t *data = read_file(members[i].path, &size), *z = NULL;
+      uint32_t flags = 0;
+
+      stored = size;
+      if (compress && size > 0)
+        {
+          size_t zlen;
+          z = p8z_compress(data, size, BLOCK_SIZE, &zlen);
+          if (z != NULL && zlen < size)
+            {
+              stored = zlen;
+              flags = 1;
+            }
+        }
+      /* Members of more than a sector start on a sector boundary, so
+         reading them never touches a sector that belongs to another. */
+      if (stored > SECTOR_SIZE && pos % SECTOR_SIZE != 0)
+        {
+          static const uint8_t zero[SECTOR_SIZE];
+          size_t pad = SECTOR_SIZE - pos % SECTOR_SIZE;
+          fwrite(zero, 1, pad, out);
+          pos += pad;
+        }
+      put_le32(entry, 16 + nmembers * 20 + name_pos);
+      put_le32(entry + 4, pos);
+      put_le32(entry + 8, stored);
+      put_le32(entry + 12, size);
+      put_le32(entry + 16, flags);
+      strcpy((char *)toc + 16 + nmembers * 20 + name_pos, members[i].name);
+      name_pos += strlen(members[i].name) + 1;
+      if (fwrite(flags ? z : data, 1, stored, out) != stored)
+        {
+          perror(argv[argi]);
+          return 1;
+        }
+      pos += stored;
+      total_in += size;
+      free(data);
+      free(z);
+    }
+  if (fseek(out, 0, SEEK_SET) != 0 || fwrite(toc, 1, header, out) != header
+      || fclose(out) != 0)
+    {
+      perror(argv[argi]);
+      return 1;
+    }
+  printf("%s: %zu files, %zu -> %zu bytes\n", argv[argi], nmembers, total_in, pos);
+  return 0;
+}
@@ -0,0 +1,394 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* Host tool: send files to a board running _xfer_receive(). The protocol
+ * is described in src/xfer.c.
+ *
+ *   cc -O2 -o p8send tools/p8send.c
+ *   p8send [-b baud] device file[=name] ...
+ *
+ * Each file is stored on the board under name, or under its own path if
+ * no name is given. device may also be a pty for testing. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BLOCK 512
+#define MAX_WINDOW 32
+#define MAX_FRAME (1 + 4 + BLOCK + 4)
+#define REPLY_MS 300            /* time to write a window and send an A */
+#define RETRIES 20
+
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+static int fd;
+static uint32_t crc_table[256];
+
+static void make_crc_table(void)
+{
+  for (uint32_t n = 0; n < 256; n++)
+    {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++)
+        c = (c & 1) ? (c >> 1) ^ 0xEDB88320u : c >> 1;
+      crc_table[n] = c;
+    }
+}
+
+static uint32_t crc32(const uint8_t *p, size_t len)
+{
+  uint32_t c = 0xFFFFFFFFu;
+  while (len-- > 0)
+    c = crc_table[(c ^ *p++) & 0xff] ^ (c >> 8);
+  return ~c;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static long long now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void write_all(const uint8_t *p, size_t len)
+{
+  while (len > 0)
+    {
+      ssize_t n = write(fd, p, len);
+      if (n < 0)
+        {
+          if (errno == EAGAIN || errno == EINTR)
+            {
+              struct pollfd pfd = { fd, POLLOUT, 0 };
+              poll(&pfd, 1, 100);
+              continue;
+            }
+          perror("write");
+          exit(1);
+        }
+      p += n;
+      len -= n;
+    }
+}
+
+/* Send a frame of len bytes; frame must have room for the CRC. */
+static void send_frame(uint8_t *frame, size_t len)
+{
+  uint8_t out[2 * (MAX_FRAME + 255) + 2];
+  size_t n = 0;
+  put_le32(frame + len, crc32(frame, len));
+  len += 4;
+  out[n++] = SLIP_END;
+  for (size_t i = 0; i < len; i++)
+    {
+      if (frame[i] == SLIP_END)
+        {
+          out[n++] = SLIP_ESC;
+          out[n++] = SLIP_ESC_END;
+        }
+      else if (frame[i] == SLIP_ESC)
+        {
+          out[n++] = SLIP_ESC;
+          out[n++] = SLIP_ESC_ESC;
+        }
+      else
+        out[n++] = frame[i];
+    }
+  out[n++] = SLIP_END;
+  write_all(out, n);
+}
+
+/* Read the next intact frame, or return -1 after timeout_ms. */
+static int recv_frame(uint8_t *buf, size_t size, int timeout_ms)
+{
+  static uint8_t in[4096];
+  static size_t in_len, in_pos;
+  static size_t len;
+  static int esc, overflow;
+  long long deadline = now_ms() + timeout_ms;
+  for (;;)
+    {
+      while (in_pos < in_len)
+        {
+          int c = in[in_pos++];
+          if (c == SLIP_END)
+            {
+              size_t n = len;
+              int bad = overflow;
+              len = 0;
+              esc = overflow = 0;
+              if (n > 4 && !bad && crc32(buf, n - 4) == get_le32(buf + n - 4))
+                return n - 4;
+              continue;
+            }
+          if (c == SLIP_ESC)
+            {
+              esc = 1;
+              continue;
+            }
+          if (esc)
+            {
+              c = c == SLIP_ESC_END ? SLIP_END : c == SLIP_ESC_ESC ? SLIP_ESC : c;
+              esc = 0;
+            }
+          if (len < size)
+            buf[len++] = c;
+          else
+            overflow = 1;
+        }
+      long long left = deadline - now_ms();
+      if (left <= 0)
+        return -1;
+      struct pollfd pfd = { fd, POLLIN, 0 };
+      if (poll(&pfd, 1, left) <= 0)
+        continue;
+      ssize_t n = read(fd, in, sizeof(in));
+      if (n < 0 && errno != EAGAIN && errno != EINTR)
+        {
+          perror("read");
+          exit(1);
+        }
+      in_len = n > 0 ? n : 0;
+      in_pos = 0;
+    }
+}
+
+static void send_block(const uint8_t *data, uint32_t size, uint32_t block)
+{
+  uint8_t frame[MAX_FRAME];
+  uint32_t len = size - block * BLOCK < BLOCK ? size - block * BLOCK : BLOCK;
+  frame[0] = 'D';
+  put_le32(frame + 1, block);
+  memcpy(frame + 5, data + (size_t)block * BLOCK, len);
+  send_frame(frame, 5 + len);
+}
+
+static int send_file(const char *path, const char *name)
+{
+  uint8_t frame[MAX_FRAME + 255], reply[MAX_FRAME];
+  uint8_t *data;
+  uint32_t size, nblocks, base = 0, acked = 0, token = 0, window;
+  FILE *f = fopen(path, "rb");
+  long len;
+  int n, tries;
+  long long start = now_ms();
+
+  if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0)
+    {
+      perror(path);
+      return 1;
+    }
+  rewind(f);
+  data = malloc(len ? len : 1);
+  if (data == NULL || fread(data, 1, len, f) != (size_t)len)
+    {
+      perror(path);
+      return 1;
+    }
+  fclose(f);
+  if (strlen(name) > 255)
+    {
+      fprintf(stderr, "%s: name too long\n", name);
+      return 1;
+    }
+  size = len;
+  nblocks = (size + BLOCK - 1) / BLOCK;
+
+  frame[0] = 'O';
+  put_le32(frame + 1, size);
+  memcpy(frame + 5, name, strlen(name));
+  for (tries = 0;; tries++)
+    {
+      if (tries == RETRIES)
+        {
+          fprintf(stderr, "%s: no answer\n", name);
+          return 1;
+        }
+      send_frame(frame, 5 + strlen(name));
+      n = recv_frame(reply, sizeof(reply), 1000);
+      if (n >= 7 && reply[0] == 'o')
+        break;
+    }
+  if (get_le32(reply + 1) != 0)
+    {
+      fprintf(stderr, "%s: %s\n", name, strerror(get_le32(reply + 1)));
+      return 1;
+    }
+  window = reply[5] | (reply[6] << 8);
+  if (window == 0 || window > MAX_WINDOW)
+    window = MAX_WINDOW;
+
+  while (base < nblocks)
+    {
+      /* Send every block of the window that has not arrived. */
+      for (uint32_t i = 0; i < window && base + i < nblocks; i++)
+        if (!(acked & ((uint32_t)1 << i)))
+          send_block(data, size, base + i);
+      for (tries = 0;; tries++)
+        {
+          if (tries == RETRIES)
+            {
+              fprintf(stderr, "%s: no answer\n", name);
+              return 1;
+            }
+          n = recv_frame(reply, sizeof(reply), REPLY_MS);
+          if (n >= 5 && reply[0] == 'e')
+            {
+              fprintf(stderr, "%s: %s\n", name, strerror(get_le32(reply + 1)));
+              return 1;
+            }
+          if (n >= 13 && reply[0] == 'A')
+            {
+              uint32_t ack_base = get_le32(reply + 1);
+              if (ack_base > base)
+                {
+                  base = ack_base;
+                  acked = get_le32(reply + 5);
+                  break;
+                }
+              /* Only the answer to the latest poll says what went missing;
+                 anything else may predate blocks still on their way. */
+              if (ack_base == base && token != 0 && get_le32(reply + 9) == token)
+                {
+                  acked |= get_le32(reply + 5);
+                  break;
+                }
+              continue;
+            }
+          if (n < 0)
+            {
+              uint8_t poll_frame[1 + 4 + 4];
+              poll_frame[0] = 'P';
+              put_le32(poll_frame + 1, ++token);
+              send_frame(poll_frame, 5);
+            }
+        }
+      fprintf(stderr, "\r%s: %u/%u", name, base * BLOCK < size ? base * BLOCK : size,
+              size);
+    }
+
+  for (tries = 0;; tries++)
+    {
+      uint8_t end_frame[1 + 4];
+      if (tries == RETRIES)
+        {
+          fprintf(stderr, "\n%s: no answer\n", name);
+          return 1;
+        }
+      end_frame[0] = 'E';
+      send_frame(end_frame, 1);
+      n = recv_frame(reply, sizeof(reply), 1000);
+      if (n >= 5 && reply[0] == 'e')
+        break;
+    }
+  if (get_le32(reply + 1) != 0)
+    {
+      fprintf(stderr, "\n%s: %s\n", name, strerror(get_le32(reply + 1)));
+      return 1;
+    }
+  long long ms = now_ms() - start;
+  fprintf(stderr, "\r%s: %u bytes in %lld.%03llds\n", name, size, ms / 1000, ms % 1000);
+  free(data);
+  return 0;
+}
+
+static speed_t baud_constant(long baud)
+{
+  switch (baud)
+    {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+#ifdef B460800
+    case 460800: return B460800;
+#endif
+#ifdef B921600
+    case 921600: return B921600;
+#endif
+    default: return 0;
+    }
+}
+
+int main(int argc, char **argv)
+{
+  long baud = 115200;
+  int argi = 1, ret = 0;
+  struct termios tio;
+
+  if (argc > 3 && strcmp(argv[1], "-b") == 0)
+    {
+      baud = strtol(argv[2], NULL, 0);
+      argi = 3;
+    }
+  if (argc - argi < 2 || baud_constant(baud) == 0)
+    {
+      fprintf(stderr, "usage: %s [-b baud] device file[=name] ...\n", argv[0]);
+      return 1;
+    }
+  fd = open(argv[argi], O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0)
+    {
+      perror(argv[argi]);
+      return 1;
+    }
+  if (tcgetattr(fd, &tio) == 0)
+    {
+      cfmakeraw(&tio);
+      tio.c_cflag |= CLOCAL | CREAD;
+      tio.c_cflag &= ~CRTSCTS;
+      cfsetispeed(&tio, baud_constant(baud));
+      cfsetospeed(&tio, baud_constant(baud));
+      tcsetattr(fd, TCSANOW, &tio);
+    }
+  make_crc_table();
+
+  for (argi++; argi < argc && ret == 0; argi++)
+    {
+      char *path = argv[argi], *name = strchr(path, '=');
+      if (name != NULL)
+        *name++ = '\0';
+      else
+        name = path;
+      ret = send_file(path, name);
+    }
+  close(fd);
+  return ret;
+}
@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* Host tool: turn binary trace records from src/trace.c back into text.
+ *
+ *   cc -O2 -o p8trace tools/p8trace.c
+ *   p8trace program.elf [input]
+ *
+ * The formats are read from the .trace_fmt section of the program that
+ * wrote the trace. input (default: standard input) is either a trace file
+ * written with _trace_to_file(), or a capture of the serial output, in
+ * which case text outside the trace frames is passed through. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_ID_DROPPED 0xFFFFFFu
+#define MAX_ARGS 6
+
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+static char *formats;
+static size_t formats_size;
+static uint32_t formats_base;
+static uint64_t time_high;
+static uint32_t last_time;
+
+static uint8_t *read_all(FILE *f, size_t *size)
+{
+  size_t len = 0, cap = 65536;
+  uint8_t *data = malloc(cap);
+  size_t n;
+  while (data != NULL && (n = fread(data + len, 1, cap - len, f)) > 0)
+    {
+      len += n;
+      if (len == cap)
+        data = realloc(data, cap *= 2);
+    }
+  if (data == NULL)
+    {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  *size = len;
+  return data;
+}
+
+static uint64_t get(const uint8_t *p, int size, int big)
+{
+  uint64_t v = 0;
+  for (int i = 0; i < size; i++)
+    v |= (uint64_t)p[big ? i : size - 1 - i] << (8 * (size - 1 - i));
+  return v;
+}
+
+/* Find .trace_fmt in a 32- or 64-bit ELF file of either byte order. */
+static void load_formats(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  uint8_t *elf;
+  size_t size;
+  if (f == NULL)
+    {
+      perror(path);
+      exit(1);
+    }
+  elf = read_all(f, &size);
+  fclose(f);
+  if (size < 52 || memcmp(elf, "\177ELF", 4) != 0)
+    {
+      fprintf(stderr, "%s: not an ELF file\n", path);
+      exit(1);
+    }
+  int is64 = elf[4] == 2, big = elf[5] == 2;
+  uint64_t shoff = get(elf + (is64 ? 0x28 : 0x20), is64 ? 8 : 4, big);
+  unsigned shentsize = get(elf + (is64 ? 0x3a : 0x2e), 2, big);
+  unsigned shnum = get(elf + (is64 ? 0x3c : 0x30), 2, big);
+  unsigned shstrndx = get(elf + (is64 ? 0x3e : 0x32), 2, big);
+  if (shoff + (uint64_t)shnum * shentsize > size || shstrndx >= shnum)
+    {
+      fprintf(stderr, "%s: bad section headers\n", path);
+      exit(1);
+    }
+#define SH(i) (elf + shoff + (uint64_t)(i) * shentsize)
+#define SH_ADDR(i) get(SH(i) + (is64 ? 0x10 : 0x0c), is64 ? 8 : 4, big)
+#define SH_OFFSET(i) get(SH(i) + (is64 ? 0x18 : 0x10), is64 ? 8 : 4, big)
+#define SH_SIZE(i) get(SH(i) + (is64 ? 0x20 : 0x14), is64 ? 8 : 4, big)
+  uint64_t strtab = SH_OFFSET(shstrndx);
+  for (unsigned i = 0; i < shnum; i++)
+    {
+      uint64_t name = strtab + get(SH(i), 4, big);
+      if (name < size && strcmp((char *)elf + name, ".trace_fmt") == 0
+          && SH_OFFSET(i) + SH_SIZE(i) <= size)
+        {
+          formats_size = SH_SIZE(i);
+          formats = malloc(formats_size + 1);
+          memcpy(formats, elf + SH_OFFSET(i), formats_size);
+          formats[formats_size] = '\0';
+          /* Only 24 bits of the address are recorded. */
+          formats_base = SH_ADDR(i) & 0xFFFFFF;
+          free(elf);
+          return;
+        }
+    }
+  fprintf(stderr, "%s: no .trace_fmt section\n", path);
+  exit(1);
+}
+
+/* Print fmt with the argument words substituted, printf style. */
+static void print_formatted(const char *fmt, const uint32_t *args, unsigned nargs)
+{
+  unsigned next = 0;
+  while (*fmt)
+    {
+      char spec[32];
+      size_t n = 0;
+      if (*fmt != '%')
+        {
+          putchar(*fmt++);
+          continue;
+        }
+      if (fmt[1] == '%')
+        {
+          putchar('%');
+          fmt += 2;
+          continue;
+        }
+      spec[n++] = *fmt++;
+      while (*fmt && strchr("-+ #0123456789.", *fmt) && n < sizeof(spec) - 3)
+        spec[n++] = *fmt++;
+      while (*fmt && strchr("hlLqjzt", *fmt))
+        fmt++;
+      if (*fmt == '\0')
+        break;
+      char conv = *fmt++;
+      uint32_t arg = next < nargs ? args[next] : 0;
+      next++;
+      switch (conv)
+        {
+        case 'd': case 'i':
+          spec[n++] = conv;
+          spec[n] = '\0';
+          printf(spec, (int32_t)arg);
+          break;
+        case 'u': case 'x': case 'X': case 'o': case 'c':
+          spec[n++] = conv;
+          spec[n] = '\0';
+          printf(spec, (unsigned)arg);
+          break;
+        case 'p':
+          printf("0x%08x", (unsigned)arg);
+          break;
+        case 's':
+          /* Only the address was recorded. */
+          printf("(char *)0x%08x", (unsigned)arg);
+          break;
+        default:
+          printf("%%%c", conv);
+          break;
+        }
+    }
+}
+
+static void print_record(uint32_t head, uint32_t time, const uint32_t *args)
+{
+  unsigned nargs = head >> 24;
+  uint32_t id = head & 0xFFFFFF;
+  uint64_t t;
+  if (time < last_time)
+    time_high += (uint64_t)1 << 32;
+  last_time = time;
+  t = time_high | time;
+  printf("[%6llu.%06llu] ", (unsigned long long)(t / 1000000),
+         (unsigned long long)(t % 1000000));
+  if (id == TRACE_ID_DROPPED)
+    printf("(%u records dropped)", nargs ? (unsigned)args[0] : 0);
+  else if (id - formats_base < formats_size)
+    print_formatted(formats + (id - formats_base), args, nargs);
+  else
+    {
+      printf("(unknown format %06x)", (unsigned)id);
+      for (unsigned i = 0; i < nargs; i++)
+        printf(" %08x", (unsigned)args[i]);
+    }
+  putchar('\n');
+}
+
+/* Decode whole records from big-endian words; returns bytes used. */
+static size_t decode_records(const uint8_t *p, size_t len)
+{
+  size_t pos = 0;
+  while (len - pos >= 8)
+    {
+      uint32_t head = get(p + pos, 4, 1), args[MAX_ARGS];
+      unsigned nargs = head >> 24;
+      if (nargs > MAX_ARGS)
+        {
+          fprintf(stderr, "corrupt record\n");
+          return len;
+        }
+      if (len - pos < 8 + 4 * nargs)
+        break;
+      for (unsigned i = 0; i < nargs; i++)
+        args[i] = get(p + pos + 8 + 4 * i, 4, 1);
+      print_record(head, get(p + pos + 4, 4, 1), args);
+      pos += 8 + 4 * nargs;
+    }
+  return pos;
+}
+
+/* Serial capture: text, with SLIP frames of records in between. */
+static void decode_stream(const uint8_t *p, size_t len)
+{
+  uint8_t *frame = malloc(len);
+  size_t n = 0;
+  int in_frame = 0, esc = 0;
+  for (size_t i = 0; i < len; i++)
+    {
+      uint8_t c = p[i];
+      if (c == SLIP_END)
+        {
+          if (in_frame && n > 0 && decode_records(frame, n) != n)
+            fprintf(stderr, "truncated frame\n");
+          /* Two ENDs in a row: the first closed a frame we missed. */
+          in_frame = !in_frame || n == 0;
+          n = 0;
+          esc = 0;
+          continue;
+        }
+      if (!in_frame)
+        {
+          putchar(c);
+          continue;
+        }
+      if (c == SLIP_ESC)
+        {
+          esc = 1;
+          continue;
+        }
+      if (esc)
+        {
+          c = c == SLIP_ESC_END ? SLIP_END : c == SLIP_ESC_ESC ? SLIP_ESC : c;
+          esc = 0;
+        }
+      frame[n++] = c;
+    }
+  free(frame);
+}
+
+int main(int argc, char **argv)
+{
+  FILE *in = stdin;
+  uint8_t *data;
+  size_t size;
+  if (argc < 2 || argc > 3)
+    {
+      fprintf(stderr, "usage: %s program.elf [input]\n", argv[0]);
+      return 1;
+    }
+  load_formats(argv[1]);
+  if (argc == 3 && (in = fopen(argv[2], "rb")) == NULL)
+    {
+      perror(argv[2]);
+      return 1;
+    }
+  data = read_all(in, &size);
+  if (size >= 8 && memcmp(data, "P8TR", 4) == 0)
+    {
+      if (get(data + 4, 4, 1) != 1)
+        {
+          fprintf(stderr, "unsupported trace version\n");
+          return 1;
+        }
+      if (decode_records(data + 8, size - 8) != size - 8)
+        fprintf(stderr, "trace ends in a partial record\n");
+    }
+  else
+    decode_stream(data, size);
+  return 0;
+}
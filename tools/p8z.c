@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* Host tool: compress a file into the .p8z format read by
+ * src/fatfs_p8z.c.
+ *
+ *   cc -O2 -o p8z tools/p8z.c
+ *   p8z [-b block_size] input output.p8z
+ *
+ * Each block is compressed independently with a greedy LZ4 block encoder,
+ * or stored as is if that does not make it smaller. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "p8z.h"
+
+int main(int argc, char **argv)
+{
+  uint32_t block_size = 16384;
+  int argi = 1;
+  if (argc == 5 && strcmp(argv[1], "-b") == 0)
+    {
+      block_size = strtoul(argv[2], NULL, 0);
+      argi = 3;
+    }
+  if (argc - argi != 2 || block_size == 0 || block_size > 65536
+      || (block_size & (block_size - 1)) != 0)
+    {
+      fprintf(stderr, "usage: %s [-b block_size] input output.p8z\n"
+              "block_size is a power of two up to 65536\n", argv[0]);
+      return 1;
+    }
+
+  FILE *f = fopen(argv[argi], "rb");
+  if (f == NULL)
+    {
+      perror(argv[argi]);
+      return 1;
+    }
+  size_t size = 0, cap = 65536;
+  uint8_t *in = malloc(cap);
+  size_t n;
+  while (in && (n = fread(in + size, 1, cap - size, f)) > 0)
+    {
+      size += n;
+      if (size == cap)
+        in = realloc(in, cap *= 2);
+    }
+  fclose(f);
+  if (in == NULL || size > 0xffffffffu)
+    {
+      fprintf(stderr, "%s: too big\n", argv[argi]);
+      return 1;
+    }
+
+  size_t pos;
+  uint8_t *out = p8z_compress(in, size, block_size, &pos);
+  if (out == NULL)
+    {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+    }
+
+  f = fopen(argv[argi + 1], "wb");
+  if (f == NULL || fwrite(out, 1, pos, f) != pos || fclose(f) != 0)
+    {
+      perror(argv[argi + 1]);
+      return 1;
+    }
+  printf("%s: %zu -> %zu bytes\n", argv[argi + 1], size, pos);
+  return 0;
+}
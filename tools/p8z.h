@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2025 Chris January
+ *
+ * The authors hereby grant permission to use, copy, modify, distribute,
+ * and license this software and its documentation for any purpose, provided
+ * that existing copyright notices are retained in all copies and that this
+ * notice is included verbatim in any distributions. No written agreement,
+ * license, or royalty fee is required for any of the authorized uses.
+ * Modifications to this software may be copyrighted by their authors
+ * and need not follow the licensing terms described here, provided that
+ * the new terms are clearly indicated on the first page of each file where
+ * they apply.
+ */
+
+/* LZ4 block encoder and .p8z stream writer shared by the host tools. See
+ * src/fatfs_p8z.c for the format. */
+
+#ifndef P8Z_H
+#define P8Z_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_BITS 14
+#define MIN_MATCH 4
+#define LAST_LITERALS 5         /* the format ends with at least 5 literals */
+#define MF_LIMIT 12             /* and no match starts in the last 12 bytes */
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static uint32_t hash4(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static uint8_t *put_length(uint8_t *op, size_t len)
+{
+  while (len >= 255)
+    {
+      *op++ = 255;
+      len -= 255;
+    }
+  *op++ = len;
+  return op;
+}
+
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *lit, size_t nlit,
+                             size_t offset, size_t mlen)
+{
+  uint8_t *token = op++;
+  *token = (nlit >= 15 ? 15 : nlit) << 4;
+  if (nlit >= 15)
+    op = put_length(op, nlit - 15);
+  memcpy(op, lit, nlit);
+  op += nlit;
+  if (mlen == 0)
+    return op;
+  *op++ = offset;
+  *op++ = offset >> 8;
+  mlen -= MIN_MATCH;
+  *token |= mlen >= 15 ? 15 : mlen;
+  if (mlen >= 15)
+    op = put_length(op, mlen - 15);
+  return op;
+}
+
+/* Compress in[0..len) into out, which must hold len + len / 255 + 16 bytes.
+   Returns the compressed length. */
+static size_t lz4_encode(const uint8_t *in, size_t len, uint8_t *out)
+{
+  static uint32_t table[1 << HASH_BITS];
+  const uint8_t *ip = in, *anchor = in, *end = in + len;
+  uint8_t *op = out;
+
+  memset(table, 0xff, sizeof(table));
+  if (len > MF_LIMIT)
+    {
+      const uint8_t *match_limit = end - MF_LIMIT;
+      while (ip < match_limit)
+        {
+          uint32_t h = hash4(ip);
+          uint32_t cand = table[h];
+          table[h] = ip - in;
+          if (cand == 0xffffffff || ip - (in + cand) > 65535
+              || memcmp(in + cand, ip, MIN_MATCH) != 0)
+            {
+              ip++;
+              continue;
+            }
+          const uint8_t *match = in + cand;
+          size_t mlen = MIN_MATCH;
+          while (ip + mlen < end - LAST_LITERALS && match[mlen] == ip[mlen])
+            mlen++;
+          while (ip > anchor && match > in && ip[-1] == match[-1])
+            {
+              ip--;
+              match--;
+              mlen++;
+            }
+          op = put_sequence(op, anchor, ip - anchor, ip - match, mlen);
+          ip += mlen;
+          anchor = ip;
+        }
+    }
+  op = put_sequence(op, anchor, end - anchor, 0, 0);
+  return op - out;
+}
+
+/* Compress size bytes into a complete .p8z stream. Returns a malloc'ed
+   buffer and sets *out_len, or returns NULL if out of memory. */
+static uint8_t *p8z_compress(const uint8_t *in, size_t size, uint32_t block_size,
+                             size_t *out_len)
+{
+  uint32_t nblocks = (size + block_size - 1) / block_size;
+  size_t header = 16 + (nblocks + 1) * 4;
+  uint8_t *out = malloc(header + size + nblocks * (block_size / 255 + 16));
+  uint8_t *tmp = malloc(block_size + block_size / 255 + 16);
+  if (out == NULL || tmp == NULL)
+    {
+      free(out);
+      free(tmp);
+      return NULL;
+    }
+  memcpy(out, "P8Z1", 4);
+  put_le32(out + 4, size);
+  put_le32(out + 8, block_size);
+  put_le32(out + 12, nblocks);
+  size_t pos = header;
+  for (uint32_t i = 0; i < nblocks; i++)
+    {
+      size_t len = size - (size_t)i * block_size;
+      if (len > block_size)
+        len = block_size;
+      const uint8_t *src = in + (size_t)i * block_size;
+      size_t clen = lz4_encode(src, len, tmp);
+      put_le32(out + 16 + i * 4, pos);
+      if (clen < len)
+        memcpy(out + pos, tmp, clen);
+      else
+        memcpy(out + pos, src, clen = len);
+      pos += clen;
+    }
+  put_le32(out + 16 + nblocks * 4, pos);
+  free(tmp);
+  *out_len = pos;
+  return out;
+}
+
+#endif